@@ -1,128 +1,387 @@
-#ifndef ODRIVE_H
-#define ODRIVE_H
-
-#include <iostream>
-#include <sstream>
-#include <stdint.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <getopt.h>
-#include <iostream>
-#include <string>
-#include <vector>
-#include <endian.h>
-#include <mutex>
-#include <cstring>
-#include "odrive_definitions.h"
-
-#include <libusb-1.0/libusb.h>
-#include <json/json.h>
-
-
-// ODrive Device Info
-#define ODRIVE_USB_VENDORID     0x1209
-#define ODRIVE_USB_PRODUCTID    0x0D32
-
-// ODrive USB Protool
-#define ODRIVE_TIMEOUT 2000
-#define ODRIVE_MAX_BYTES_TO_RECEIVE 64
-#define ODRIVE_MAX_RESULT_LENGTH 100
-//#define ODRIVE_DEFAULT_CRC_VALUE 0x7411
-#define ODRIVE_DEFAULT_CRC_VALUE 0x9b40
-#define ODRIVE_PROTOCOL_VERSION 1
-
-// ODrive Comm
-#define ODRIVE_COMM_SUCCESS 0
-#define ODRIVE_COMM_ERROR   1
-
-// Endpoints (from target)
-#define CDC_IN_EP                                   0x81  /* EP1 for data IN (target) */
-#define CDC_OUT_EP                                  0x01  /* EP1 for data OUT (target) */
-#define CDC_CMD_EP                                  0x82  /* EP2 for CDC commands */
-#define ODRIVE_IN_EP                                0x83  /* EP3 IN: ODrive device TX endpoint */
-#define ODRIVE_OUT_EP                               0x03  /* EP3 OUT: ODrive device RX endpoint */
-
-// CDC Endpoints parameters
-#define CDC_DATA_HS_MAX_PACKET_SIZE                 0x40  /* Endpoint IN & OUT Packet size */
-#define CDC_DATA_FS_MAX_PACKET_SIZE                 0x40  /* Endpoint IN & OUT Packet size */
-#define CDC_CMD_PACKET_SIZE                         0x08  /* Control Endpoint Packet size */
-
-#define USB_CDC_CONFIG_DESC_SIZ                     (67 + 39)
-#define CDC_DATA_HS_IN_PACKET_SIZE                  CDC_DATA_HS_MAX_PACKET_SIZE
-#define CDC_DATA_HS_OUT_PACKET_SIZE                 CDC_DATA_HS_MAX_PACKET_SIZE
-
-#define CDC_DATA_FS_IN_PACKET_SIZE                  CDC_DATA_FS_MAX_PACKET_SIZE
-#define CDC_DATA_FS_OUT_PACKET_SIZE                 CDC_DATA_FS_MAX_PACKET_SIZE
-
-#define CDC_SEND_ENCAPSULATED_COMMAND               0x00
-#define CDC_GET_ENCAPSULATED_RESPONSE               0x01
-#define CDC_SET_COMM_FEATURE                        0x02
-#define CDC_GET_COMM_FEATURE                        0x03
-#define CDC_CLEAR_COMM_FEATURE                      0x04
-#define CDC_SET_LINE_CODING                         0x20
-#define CDC_GET_LINE_CODING                         0x21
-#define CDC_SET_CONTROL_LINE_STATE                  0x22
-#define CDC_SEND_BREAK                              0x23
-
-#define ODRIVE_OK                                   0 
-#define ODRIVE_FAILED                               1 
-
-typedef std::vector<uint8_t> commBuffer;
-
-namespace dhr{
-	class odrive {
-	public:
-		odrive();  // Constructor: Initialize USB Library
-		~odrive(); // Destructor
-		int init(uint64_t serialNumber); //Find endpoint for communication 
-		void close(void); // close endpoint
-
-		template<typename T>
-            int getData(int id, T& value); // Read value from ODrive
-        template<typename TT> 
-            int setData(int id, const TT& value); // Write value to ODrive
-
-        int execFunc(int id); // Request function to ODrive
-
-        int endpointRequest(int endpoint_id, commBuffer& received_payload,
-        int& received_length, commBuffer payload, bool ack = false,
-        int length = 0, bool read = false, int address = 0); // Request an epoint from Odrive
-
-    private:
-        libusb_context* libusb_context_;
-        short outbound_seq_no_ = 0;
-        libusb_device_handle *odrive_handle_ = NULL;
-        std::mutex ep_lock;
-
-        void appendShortToCommBuffer(commBuffer& buf, const short value);
-        void appendIntToCommBuffer(commBuffer& buf, const int value);
-        commBuffer decodeODrivePacket(commBuffer& buf, short& seq_no, commBuffer& received_packet);
-        commBuffer createODrivePacket(short seq_no, int endpoint_id, short response_size,
-        bool read, int address, const commBuffer& input);
-
-	};
-
-    typedef struct _odrive_object {
-		std::string name;
-		int id;
-		std::string type;
-		std::string access;
-     }odrive_object;
-
-    int getJson(odrive *endpoint, Json::Value *json); 
-	int getObjectByName(Json::Value odrive_json, std::string name, odrive_object *odo);
-    
-	
-    template<typename TT>
-		int readOdriveData(odrive *endpoint, Json::Value odrive_json,
-        std::string command, TT &value);
-
-    template<typename T>
-        int writeOdriveData(odrive *endpoint, Json::Value odrive_json,
-        std::string object, T &value);
-    
-    int execOdriveFunc(odrive *endpoint, Json::Value odrive_json, std::string object);
-
-}
-#endif
+#ifndef ODRIVE_H
+#define ODRIVE_H
+
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <endian.h>
+#include <poll.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include "odrive_definitions.h"
+#include "odrive_log.h"
+
+#include <libusb-1.0/libusb.h>
+#include <json/json.h>
+
+
+// ODrive Device Info
+#define ODRIVE_USB_VENDORID     0x1209
+#define ODRIVE_USB_PRODUCTID    0x0D32
+
+// ODrive USB Protool
+#define ODRIVE_TIMEOUT 2000
+#define ODRIVE_MAX_BYTES_TO_RECEIVE 64
+#define ODRIVE_MAX_RESULT_LENGTH 100
+//#define ODRIVE_DEFAULT_CRC_VALUE 0x7411
+#define ODRIVE_DEFAULT_CRC_VALUE 0x9b40 // Used until the json CRC is known
+#define ODRIVE_PROTOCOL_VERSION 1
+#define ODRIVE_CRC16_POLYNOMIAL 0x3d65
+#define ODRIVE_CRC_PROBE_TIMEOUT 50 // Wait for an answer to a cached json CRC
+#define ODRIVE_PIPELINE_DEPTH 8 // Requests kept in flight by endpointRequestBatch
+
+// Request priority classes, lower value is dispatched first
+#define ODRIVE_PRIORITY_REALTIME 0 // Control loop
+#define ODRIVE_PRIORITY_NORMAL 1 // Default
+#define ODRIVE_PRIORITY_BULK 2 // Json download, config snapshots, diagnostics
+#define ODRIVE_PRIORITY_COUNT 3
+#define ODRIVE_BULK_RATE 2000 // Bulk requests per second, 0 for no cap
+
+// ODrive Comm
+#define ODRIVE_COMM_SUCCESS 0
+#define ODRIVE_COMM_ERROR   1
+
+// Endpoints (from target)
+#define CDC_IN_EP                                   0x81  /* EP1 for data IN (target) */
+#define CDC_OUT_EP                                  0x01  /* EP1 for data OUT (target) */
+#define CDC_CMD_EP                                  0x82  /* EP2 for CDC commands */
+#define ODRIVE_IN_EP                                0x83  /* EP3 IN: ODrive device TX endpoint */
+#define ODRIVE_OUT_EP                               0x03  /* EP3 OUT: ODrive device RX endpoint */
+
+// CDC Endpoints parameters
+#define CDC_DATA_HS_MAX_PACKET_SIZE                 0x40  /* Endpoint IN & OUT Packet size */
+#define CDC_DATA_FS_MAX_PACKET_SIZE                 0x40  /* Endpoint IN & OUT Packet size */
+#define CDC_CMD_PACKET_SIZE                         0x08  /* Control Endpoint Packet size */
+
+#define USB_CDC_CONFIG_DESC_SIZ                     (67 + 39)
+#define CDC_DATA_HS_IN_PACKET_SIZE                  CDC_DATA_HS_MAX_PACKET_SIZE
+#define CDC_DATA_HS_OUT_PACKET_SIZE                 CDC_DATA_HS_MAX_PACKET_SIZE
+
+#define CDC_DATA_FS_IN_PACKET_SIZE                  CDC_DATA_FS_MAX_PACKET_SIZE
+#define CDC_DATA_FS_OUT_PACKET_SIZE                 CDC_DATA_FS_MAX_PACKET_SIZE
+
+#define CDC_SEND_ENCAPSULATED_COMMAND               0x00
+#define CDC_GET_ENCAPSULATED_RESPONSE               0x01
+#define CDC_SET_COMM_FEATURE                        0x02
+#define CDC_GET_COMM_FEATURE                        0x03
+#define CDC_CLEAR_COMM_FEATURE                      0x04
+#define CDC_SET_LINE_CODING                         0x20
+#define CDC_GET_LINE_CODING                         0x21
+#define CDC_SET_CONTROL_LINE_STATE                  0x22
+#define CDC_SEND_BREAK                              0x23
+
+#define ODRIVE_OK                                   0 
+#define ODRIVE_FAILED                               1 
+
+typedef std::vector<uint8_t> commBuffer;
+
+struct libusb_transfer;
+
+namespace dhr{
+    typedef struct _odrive_request {
+        int endpoint_id = 0;            // odrive ID
+        commBuffer payload;             // data to send
+        bool ack = true;                // request acknowledge
+        int length = 0;                 // data length to be read
+        bool read = false;              // send read address
+        int address = 0;                // read address
+        commBuffer received_payload;    // data read
+        int status = LIBUSB_SUCCESS;    // LIBUSB_SUCCESS on success
+    } odrive_request;
+
+    class odrive;
+    class odrive_tracer;
+
+    typedef struct _odrive_command {
+        odrive *endpoint = NULL;        // target
+        int endpoint_id = 0;            // odrive ID
+        commBuffer value;               // encoded value
+        int status = LIBUSB_SUCCESS;    // LIBUSB_SUCCESS on success
+    } odrive_command;
+
+    typedef struct _odrive_sync_stats {
+        int64_t skew_ns = 0;            // first to last OUT completion seen by the host
+        int64_t duration_ns = 0;        // whole exchange including acknowledges
+    } odrive_sync_stats;
+
+    typedef struct _odrive_dispatch_stats {
+        uint64_t requests = 0;          // requests dispatched
+        int64_t wait_ns_max = 0;        // longest wait for the endpoint
+        double wait_ns_mean = 0;
+    } odrive_dispatch_stats;
+
+    int getRequestPriority(void); // Priority class of the calling thread
+    void setRequestPriority(int priority);
+
+    /*
+     * Sets the priority class of the calling thread's requests for a scope
+     */
+    class odrive_priority_scope {
+    public:
+        explicit odrive_priority_scope(int priority);
+        ~odrive_priority_scope();
+
+    private:
+        int previous_;
+    };
+
+    /*
+     * Endpoint lock granted by priority class of the calling thread
+     * A waiter is served only once no higher class waits, in arrival order
+     * within its class. Bulk requests also draw from a token bucket, so
+     * they can not saturate the bus even when nothing else waits.
+     */
+    class odrive_dispatch_lock {
+    public:
+        odrive_dispatch_lock();
+        void lock(int requests = 1);
+        void unlock(void);
+        void setBulkRate(int requests_per_second);
+        odrive_dispatch_stats getStats(int priority);
+
+    private:
+        bool bulkReady(int requests, int64_t now, int64_t *wait_ns);
+
+        std::mutex lock_;
+        std::condition_variable ready_[ODRIVE_PRIORITY_COUNT];
+        int waiting_[ODRIVE_PRIORITY_COUNT] = { 0 };
+        uint64_t next_ticket_[ODRIVE_PRIORITY_COUNT] = { 0 };
+        uint64_t serving_[ODRIVE_PRIORITY_COUNT] = { 0 };
+        bool held_ = false;
+        int bulk_rate_;
+        double bulk_tokens_;
+        int64_t bulk_refill_ns_;
+        odrive_dispatch_stats stats_[ODRIVE_PRIORITY_COUNT];
+    };
+
+	class odrive {
+	public:
+		odrive();  // Constructor: Initialize USB Library
+		~odrive(); // Destructor
+		int init(uint64_t serialNumber); //Find endpoint for communication 
+		void close(void); // close endpoint
+
+		template<typename T>
+            int getData(int id, T& value); // Read value from ODrive
+        template<typename TT> 
+            int setData(int id, const TT& value); // Write value to ODrive
+
+        int execFunc(int id); // Request function to ODrive
+
+        int endpointRequest(int endpoint_id, commBuffer& received_payload,
+        int& received_length, commBuffer payload, bool ack = false,
+        int length = 0, bool read = false, int address = 0,
+        unsigned int timeout = ODRIVE_TIMEOUT); // Request an epoint from Odrive
+        int endpointRequestBatch(std::vector<odrive_request>& requests,
+            bool atomic = false); // Pipelined endpoint requests, atomic keeps bulk batches in one piece
+        static int requestSynchronized(std::vector<odrive_command>& commands,
+        odrive_sync_stats *stats = NULL); // Write to several targets at once
+
+        void setJsonCrc(uint16_t crc); // Set json CRC sent with every request
+        uint16_t getJsonCrc(void);
+        int probeJsonCrc(uint16_t crc, int endpoint_id, int length); // Check target accepts a json CRC
+        void setTracer(odrive_tracer *tracer); // Record every packet, NULL to stop
+        void setBulkRate(int requests_per_second); // Cap bulk priority requests, 0 for no cap
+        odrive_dispatch_stats getDispatchStats(int priority); // Wait for the endpoint per class
+
+    private:
+        libusb_context* libusb_context_;
+        short outbound_seq_no_ = 0;
+        std::atomic<uint16_t> json_crc_{ODRIVE_DEFAULT_CRC_VALUE};
+        std::atomic<odrive_tracer *> tracer_{NULL};
+        std::atomic<int> tracer_users_{0}; // requests holding a pinned tracer
+        libusb_device_handle *odrive_handle_ = NULL;
+        odrive_dispatch_lock ep_lock;
+        std::vector<libusb_transfer *> out_transfers_;
+        std::vector<libusb_transfer *> in_transfers_;
+
+        typedef struct _pipeline_window {
+            odrive_request *requests;
+            int count;
+            int acks;
+            int sent;
+            int pending;
+            int status;
+            short seq_nos[ODRIVE_PIPELINE_DEPTH];
+            commBuffer packets[ODRIVE_PIPELINE_DEPTH];
+            unsigned char received[ODRIVE_PIPELINE_DEPTH][ODRIVE_MAX_RESULT_LENGTH];
+            int64_t sent_ns[ODRIVE_PIPELINE_DEPTH]; // OUT transfer completion time
+            int64_t received_ns[ODRIVE_PIPELINE_DEPTH]; // IN transfer completion time
+        } pipeline_window;
+        pipeline_window window_;
+
+        short nextSeqNo(void);
+        static void LIBUSB_CALL pipelineTransferDone(struct libusb_transfer *transfer);
+        int pipelinePrepare(odrive_request *requests, int count);
+        int pipelineStart(void);
+        void pipelineCancel(void);
+        bool pipelinePoll(struct timeval *tv);
+        static void getPollFds(const std::vector<odrive *>& targets, std::vector<struct pollfd>& fds);
+        static void pipelineWait(const std::vector<odrive *>& targets, std::vector<struct pollfd>& fds);
+        odrive_tracer *pinTracer(void);
+        void unpinTracer(odrive_tracer *tracer);
+        void trace(odrive_tracer *tracer, uint8_t type, uint16_t seq_no, uint16_t endpoint_id,
+            uint16_t length, int status = 0, int64_t timestamp_ns = 0);
+        void pipelineTrace(odrive_tracer *tracer, int index, int ack);
+        int pipelineFinish(void);
+        int pipelineRequests(odrive_request *requests, int count);
+        void appendShortToCommBuffer(commBuffer& buf, const short value);
+        void appendIntToCommBuffer(commBuffer& buf, const int value);
+        commBuffer decodeODrivePacket(commBuffer& buf, short& seq_no, commBuffer& received_packet);
+        commBuffer createODrivePacket(short seq_no, int endpoint_id, short response_size,
+        bool read, int address, const commBuffer& input);
+
+	};
+
+    typedef struct _odrive_object {
+		std::string name;
+		int id;
+		std::string type;
+		std::string access;
+     }odrive_object;
+
+    typedef struct _odrive_function {
+        odrive_object object;                   // function itself
+        std::vector<odrive_object> inputs;      // argument endpoints, written before the call
+        std::vector<odrive_object> outputs;     // result endpoints, read after the call
+    } odrive_function;
+
+    typedef struct _odrive_call {
+        odrive_function function;
+        std::vector<commBuffer> inputs;         // encoded arguments
+        std::vector<commBuffer> outputs;        // encoded results
+        int status = LIBUSB_SUCCESS;            // LIBUSB_SUCCESS on success
+    } odrive_call;
+
+    int64_t getMonotonicTime(void); // Monotonic clock in nanoseconds
+    uint16_t calcCrc16(uint16_t remainder, const uint8_t *data, size_t length);
+    int getTypeSize(const std::string& type);
+
+    odrive_request makeReadRequest(int id, int length); // Request reading a value
+    odrive_request makeWriteRequest(int id, const commBuffer& value); // Request writing a value
+
+    int getJson(odrive *endpoint, Json::Value *json, std::string *text = NULL);
+    int getJsonCached(odrive *endpoint, Json::Value *json);
+	int getObjectByName(Json::Value odrive_json, std::string name, odrive_object *odo);
+    
+	
+    template<typename TT>
+		int readOdriveData(odrive *endpoint, Json::Value odrive_json,
+        std::string command, TT &value);
+
+    template<typename T>
+        int writeOdriveData(odrive *endpoint, Json::Value odrive_json,
+        std::string object, T &value);
+    
+    int execOdriveFunc(odrive *endpoint, Json::Value odrive_json, std::string object);
+
+    int getFunctionByName(const Json::Value& odrive_json, std::string name, odrive_function *function);
+    int makeOdriveCall(const Json::Value& odrive_json, std::string name, odrive_call *call);
+
+    template<typename T>
+        int setCallInput(odrive_call *call, size_t index, const T &value);
+
+    template<typename T>
+        int getCallOutput(const odrive_call& call, size_t index, T &value);
+
+    int callOdriveFunctions(odrive *endpoint, std::vector<odrive_call>& calls,
+        int64_t *duration_ns = NULL);
+
+    /**
+     *
+     *  Build call and set its typed inputs
+     *  @param odrive_json target json
+     *  @param name function name
+     *  @param call built call
+     *  @param args inputs of the function, in schema order
+     *  @return ODRIVE_OK on success
+     *
+     */
+    template<typename A, typename... Args>
+        int makeOdriveCall(const Json::Value& odrive_json, std::string name, odrive_call *call,
+        const A& arg, const Args&... args)
+    {
+        if (makeOdriveCall(odrive_json, name, call) != ODRIVE_OK ||
+                call->inputs.size() != 1 + sizeof...(args)) {
+            return ODRIVE_FAILED;
+        }
+
+        size_t index = 0;
+        int status[] = { setCallInput(call, index++, arg), setCallInput(call, index++, args)... };
+        for (int s : status) {
+            if (s != ODRIVE_OK) {
+                return ODRIVE_FAILED;
+            }
+        }
+        return ODRIVE_OK;
+    }
+
+    /**
+     *
+     *  Call target function with typed arguments and first result
+     *  e.g. callOdriveFunction(&od, json, "get_adc_voltage", voltage, (uint32_t)3)
+     *  @param endpoint odrive enumarated endpoint
+     *  @param odrive_json target json
+     *  @param object function name
+     *  @param result first output of the function, untouched if it has none
+     *  @param args inputs of the function, in schema order
+     *  @return ODRIVE_OK on success
+     *
+     */
+    template<typename R, typename... Args>
+        int callOdriveFunction(odrive *endpoint, const Json::Value& odrive_json,
+        std::string object, R &result, const Args&... args)
+    {
+        std::vector<odrive_call> calls(1);
+        if (makeOdriveCall(odrive_json, object, &calls[0], args...) != ODRIVE_OK ||
+                calls[0].inputs.size() != sizeof...(args)) {
+            return ODRIVE_FAILED;
+        }
+        if (callOdriveFunctions(endpoint, calls) != LIBUSB_SUCCESS) {
+            return ODRIVE_FAILED;
+        }
+        return calls[0].outputs.empty() ? ODRIVE_OK : getCallOutput(calls[0], 0, result);
+    }
+
+    /**
+     *
+     *  Exec target function with typed arguments, outputs are discarded
+     *  e.g. execOdriveFunc(&od, json, "axis0.controller.move_incremental", 1.0f, true)
+     *  @param endpoint odrive enumarated endpoint
+     *  @param odrive_json target json
+     *  @param object function name
+     *  @param args inputs of the function, in schema order
+     *  @return ODRIVE_OK on success
+     *
+     */
+    template<typename A, typename... Args>
+        int execOdriveFunc(odrive *endpoint, const Json::Value& odrive_json,
+        std::string object, const A& arg, const Args&... args)
+    {
+        std::vector<odrive_call> calls(1);
+        if (makeOdriveCall(odrive_json, object, &calls[0], arg, args...) != ODRIVE_OK) {
+            return ODRIVE_FAILED;
+        }
+        return callOdriveFunctions(endpoint, calls) == LIBUSB_SUCCESS ? ODRIVE_OK : ODRIVE_FAILED;
+    }
+
+    template<typename T>
+        int makeOdriveCommand(odrive *endpoint, const Json::Value& odrive_json,
+        std::string object, const T &value, odrive_command *command);
+
+    int writeOdriveDataSync(std::vector<odrive_command>& commands,
+        odrive_sync_stats *stats = NULL);
+
+}
+#endif
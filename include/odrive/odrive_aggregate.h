@@ -0,0 +1,44 @@
+#ifndef ODRIVE_AGGREGATE_H
+#define ODRIVE_AGGREGATE_H
+
+#include <vector>
+
+// Windows shorter than this are reduced by the scalar kernel, the vector
+// setup and lane reduction cost more than they save (measured with odrive_bench)
+#define ODRIVE_AGGREGATE_VECTOR_MIN                 16 /* Samples */
+
+namespace dhr{
+    typedef struct _odrive_aggregate {
+        float min;
+        float max;
+        float mean;     // also the decimated sample
+        float rms;
+        float last;
+    } odrive_aggregate;
+
+    void aggregateScalar(const float *samples, int count, odrive_aggregate *result);
+    void aggregateVector(const float *samples, int count, odrive_aggregate *result); // SSE2 or NEON when available, scalar on short windows
+
+    /*
+     * Windowed statistics over telemetry frames
+     * Samples are stored per channel (structure of arrays) so that each
+     * window of a channel is reduced by one vector kernel pass. One result
+     * per channel is produced every window frames.
+     */
+    class odrive_aggregator {
+    public:
+        odrive_aggregator(int channels, int window);
+        bool push(const float *frame); // Add one sample per channel, true when a window completed
+        const std::vector<odrive_aggregate>& getResult(void) const; // Results of the last window
+        int getChannels(void) const;
+        int getWindow(void) const;
+
+    private:
+        int channels_;
+        int window_;
+        int count_ = 0;
+        std::vector<float> samples_; // channel major, window samples per channel
+        std::vector<odrive_aggregate> result_;
+    };
+}
+#endif
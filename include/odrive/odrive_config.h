@@ -0,0 +1,36 @@
+#ifndef ODRIVE_CONFIG_H
+#define ODRIVE_CONFIG_H
+
+#include "odrive.h"
+
+// Binary snapshot format
+#define ODRIVE_SNAPSHOT_MAGIC      0x4e534f44 /* "ODSN" */
+#define ODRIVE_SNAPSHOT_VERSION    1
+
+namespace dhr{
+    typedef struct _odrive_config_entry {
+		std::string name;   // full path, e.g. axis0.config.can_node_id
+		int id;
+		std::string type;
+		commBuffer value;   // raw little endian value
+     }odrive_config_entry;
+
+    typedef std::vector<odrive_config_entry> odrive_snapshot;
+
+    int getConfigObjects(const Json::Value& odrive_json, std::vector<odrive_object>& objects);
+
+    int takeConfigSnapshot(odrive *endpoint, const Json::Value& odrive_json,
+        odrive_snapshot& snapshot);
+    int diffConfigSnapshot(const odrive_snapshot& current, const odrive_snapshot& target,
+        odrive_snapshot& changes);
+    int applyConfigSnapshot(odrive *endpoint, const Json::Value& odrive_json,
+        const odrive_snapshot& target, int *changed = NULL);
+
+    int snapshotToJson(const odrive_snapshot& snapshot, Json::Value *json);
+    int snapshotFromJson(const Json::Value& odrive_json, const Json::Value& json,
+        odrive_snapshot& snapshot);
+    int snapshotToBinary(const odrive_snapshot& snapshot, uint16_t json_crc, commBuffer& buf);
+    int snapshotFromBinary(const Json::Value& odrive_json, uint16_t json_crc,
+        const commBuffer& buf, odrive_snapshot& snapshot);
+}
+#endif
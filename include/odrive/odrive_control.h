@@ -0,0 +1,142 @@
+#ifndef ODRIVE_CONTROL_H
+#define ODRIVE_CONTROL_H
+
+#include <atomic>
+#include <thread>
+#include "odrive.h"
+
+// Control engine
+#define ODRIVE_CONTROL_ESTIMATOR_BANDWIDTH          200.0f /* rad/s, stable down to a 200 Hz loop */
+
+namespace dhr{
+    typedef struct _odrive_axis_state {
+        float pos = 0;                  // estimated position [turns]
+        float vel = 0;                  // estimated velocity [turns/s]
+        float pos_measured = 0;         // encoder.pos_estimate
+        float pos_setpoint = 0;
+        float vel_setpoint = 0;
+        float torque_feedforward = 0;
+        float torque = 0;               // last torque command [Nm]
+    } odrive_axis_state;
+
+    typedef struct _odrive_control_stats {
+        uint64_t ticks = 0;
+        uint64_t overruns = 0;          // ticks that started a whole period late
+        uint64_t errors = 0;            // ticks with a failed exchange
+        uint64_t feedback_lost = 0;     // axis ticks without feedback, torque set to zero
+        int64_t latency_ns_last = 0;    // tick start to feedback received
+        int64_t latency_ns_max = 0;
+        double latency_ns_mean = 0;
+        int64_t jitter_ns_max = 0;      // tick start against schedule
+        double jitter_ns_rms = 0;
+    } odrive_control_stats;
+
+    /*
+     * Controller of one axis, called once per tick with the estimated state
+     */
+    class odrive_axis_controller {
+    public:
+        virtual ~odrive_axis_controller() {}
+        virtual float update(const odrive_axis_state& state, float dt) = 0; // Torque command
+        virtual void reset(void) {}
+    };
+
+    /*
+     * Cascaded P position / PI velocity loop, as on the target
+     */
+    class odrive_pid_controller : public odrive_axis_controller {
+    public:
+        odrive_pid_controller(float pos_gain, float vel_gain, float vel_integrator_gain,
+            float vel_limit, float torque_limit);
+        float update(const odrive_axis_state& state, float dt) override;
+        void reset(void) override;
+
+    private:
+        float pos_gain_;
+        float vel_gain_;
+        float vel_integrator_gain_;
+        float vel_limit_;
+        float torque_limit_;
+        float vel_integrator_ = 0;
+    };
+
+    /*
+     * Full state feedback u = k_pos * e_pos + k_vel * e_vel + feedforward
+     */
+    class odrive_state_feedback_controller : public odrive_axis_controller {
+    public:
+        odrive_state_feedback_controller(float k_pos, float k_vel, float torque_limit);
+        float update(const odrive_axis_state& state, float dt) override;
+
+    private:
+        float k_pos_;
+        float k_vel_;
+        float torque_limit_;
+    };
+
+    /*
+     * Position/velocity observer fed by encoder readings (PLL)
+     */
+    class odrive_axis_estimator {
+    public:
+        odrive_axis_estimator(float bandwidth = ODRIVE_CONTROL_ESTIMATOR_BANDWIDTH);
+        void update(float pos_measured, float dt, float *pos, float *vel);
+        void reset(float pos);
+        void reset(void); // Restart from the next reading
+
+    private:
+        float kp_;
+        float ki_;
+        float pos_ = 0;
+        float vel_ = 0;
+        bool initialized_ = false;
+    };
+
+    /*
+     * Host side control loop writing controller.input_torque
+     * Each tick exchanges one pipelined batch per target holding the torque
+     * writes computed on the previous tick and the encoder reads, so the
+     * command reaches the target one period after the feedback it uses.
+     * Targets must outlive the engine: the destructor stops a running
+     * engine, which commands zero torque on them.
+     */
+    class odrive_control_engine {
+    public:
+        odrive_control_engine();
+        ~odrive_control_engine();
+        int addAxis(odrive *endpoint, const Json::Value& odrive_json, const std::string& axis,
+            odrive_axis_controller *controller,
+            float estimator_bandwidth = ODRIVE_CONTROL_ESTIMATOR_BANDWIDTH); // Axis index, -1 on error
+        void setSetpoint(int axis, float pos, float vel = 0, float torque_feedforward = 0);
+
+        int step(float dt); // Run one tick
+        int start(int rate_hz); // Run ticks on a thread
+        void stop(void); // Stop thread and command zero torque, no-op unless started
+
+        odrive_axis_state getState(int axis);
+        odrive_control_stats getStats(void);
+
+    private:
+        typedef struct _control_axis {
+            int target;                 // index in targets_
+            int torque_request;
+            int pos_request;
+            odrive_axis_controller *controller;
+            odrive_axis_estimator estimator;
+            odrive_axis_state state;
+        } control_axis;
+
+        void run(int rate_hz);
+        int tick(float dt, int64_t jitter_ns, bool overrun);
+
+        std::vector<odrive *> targets_;
+        std::vector<std::vector<odrive_request> > exchanges_; // per target: writes, then reads
+        std::vector<control_axis> axes_;
+        std::mutex lock_; // setpoints, states and stats
+        odrive_control_stats stats_;
+        double jitter_sum_squares_ = 0;
+        std::thread thread_;
+        std::atomic<bool> running_;
+    };
+}
+#endif
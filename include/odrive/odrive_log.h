@@ -0,0 +1,45 @@
+#ifndef ODRIVE_LOG_H
+#define ODRIVE_LOG_H
+
+#include <stdint.h>
+
+// Log levels
+#define ODRIVE_LOG_DEBUG                            0
+#define ODRIVE_LOG_INFO                             1
+#define ODRIVE_LOG_WARNING                          2
+#define ODRIVE_LOG_ERROR                            3
+#define ODRIVE_LOG_NONE                             4
+
+// Events below this level are compiled out
+#ifndef ODRIVE_LOG_MIN_LEVEL
+#define ODRIVE_LOG_MIN_LEVEL                        ODRIVE_LOG_INFO
+#endif
+
+// Log queue
+#define ODRIVE_LOG_QUEUE_SIZE                       1024 /* Events, power of two */
+#define ODRIVE_LOG_TEXT_SIZE                        48   /* Text copied per event */
+
+/*
+ * Log an event without formatting or I/O in the caller
+ * message must be a string literal, text is copied and may be NULL
+ */
+#define ODRIVE_LOG_EVENT(level, message, text, value, has_value) \
+    do { \
+        if ((level) >= ODRIVE_LOG_MIN_LEVEL) { \
+            dhr::logEvent((level), (message), (text), (value), (has_value)); \
+        } \
+    } while (0)
+
+#define ODRIVE_LOG(level, message)              ODRIVE_LOG_EVENT(level, message, NULL, 0, false)
+#define ODRIVE_LOG_TEXT(level, message, text)   ODRIVE_LOG_EVENT(level, message, text, 0, false)
+#define ODRIVE_LOG_VALUE(level, message, value) ODRIVE_LOG_EVENT(level, message, NULL, value, true)
+
+namespace dhr{
+    void logStart(void); // Start writer thread, done by the odrive constructor
+    void logEvent(int level, const char *message, const char *text,
+        long long value, bool has_value); // Queue event for the writer thread
+    void setLogLevel(int level); // Runtime minimum level, above ODRIVE_LOG_MIN_LEVEL
+    void logFlush(void); // Wait until queued events are written
+    uint64_t getLogDropped(void); // Events lost to a full queue
+}
+#endif
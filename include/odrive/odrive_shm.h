@@ -0,0 +1,108 @@
+#ifndef ODRIVE_SHM_H
+#define ODRIVE_SHM_H
+
+#include <atomic>
+#include "odrive.h"
+
+// Shared memory segment
+#define ODRIVE_SHM_MAGIC                            0x4d48534f /* "OSHM" */
+#define ODRIVE_SHM_VERSION                          3
+#define ODRIVE_SHM_MAX_CHANNELS                     64
+#define ODRIVE_SHM_NAME_SIZE                        64
+#define ODRIVE_SHM_TYPE_SIZE                        16
+#define ODRIVE_SHM_COMMAND_QUEUE_SIZE               64 /* Commands, power of two */
+#define ODRIVE_SHM_READ_TIMEOUT                     10000000 /* ns a frame may stay half written */
+#define ODRIVE_SHM_COMMAND_TIMEOUT                  1000000000 /* ns a claimed command may stay unpublished */
+
+namespace dhr{
+    typedef struct _odrive_shm_channel {
+        char name[ODRIVE_SHM_NAME_SIZE];    // full path, e.g. axis0.encoder.vel_estimate
+        char type[ODRIVE_SHM_TYPE_SIZE];    // type name from target json
+        int32_t id;
+        int32_t size;
+    } odrive_shm_channel;
+
+    typedef struct _odrive_shm_command {
+        std::atomic<uint64_t> sequence;     // queue turn of the cell
+        std::atomic<int32_t> owner_pid;     // client filling the cell, 0 when free
+        char name[ODRIVE_SHM_NAME_SIZE];    // object to write
+        uint64_t value;                     // raw little endian value
+        int32_t size;
+    } odrive_shm_command;
+
+    /*
+     * Segment layout, shared by the daemon and its clients
+     * The frame is guarded by a seqlock: odd sequence while the daemon
+     * writes it. Commands go through a bounded lock-free queue. A client
+     * that dies between claiming a cell and publishing it would stall the
+     * queue; once the cell stays unpublished for ODRIVE_SHM_COMMAND_TIMEOUT
+     * and its client is gone, the daemon skips it and counts it as dropped.
+     * A client stopped (SIGSTOP) that long before recording its pid in the
+     * cell is taken for dead, its command fails.
+     */
+    typedef struct _odrive_shm_segment {
+        uint32_t magic;
+        uint32_t version;
+        std::atomic<uint32_t> ready;
+        int32_t owner_pid;                      // daemon serving the segment
+        uint32_t channel_count;
+        odrive_shm_channel channels[ODRIVE_SHM_MAX_CHANNELS];
+
+        std::atomic<uint64_t> frame_sequence;
+        std::atomic<int64_t> frame_timestamp;   // monotonic ns of the frame
+        std::atomic<uint64_t> frame_values[ODRIVE_SHM_MAX_CHANNELS];
+
+        std::atomic<uint64_t> command_enqueue;
+        uint64_t command_dequeue;               // daemon only
+        std::atomic<uint64_t> commands_dropped;
+        odrive_shm_command commands[ODRIVE_SHM_COMMAND_QUEUE_SIZE];
+    } odrive_shm_segment;
+
+    /*
+     * Daemon side: owns the target, publishes telemetry and runs commands
+     */
+    class odrive_shm_server {
+    public:
+        odrive_shm_server();
+        ~odrive_shm_server();
+        int open(const std::string& name, odrive *endpoint, const Json::Value& odrive_json,
+            const std::vector<std::string>& channels); // Create segment
+        void close(void); // Remove segment
+
+        int publish(void); // Read channels and publish them as one frame
+        int processCommands(int *processed = NULL); // Write queued commands to target
+
+    private:
+        bool skipStalledCommand(uint64_t pos); // Skip cell claimed by a dead client
+
+        std::string name_;
+        odrive_shm_segment *segment_ = NULL;
+        odrive *endpoint_ = NULL;
+        Json::Value odrive_json_;
+        std::vector<odrive_request> requests_;
+        std::map<std::string, odrive_object> objects_;
+        int64_t stalled_since_ = 0; // monotonic ns the head cell was first seen claimed but unpublished
+    };
+
+    /*
+     * Client side: reads frames and queues commands, never touches USB
+     */
+    class odrive_shm_client {
+    public:
+        odrive_shm_client();
+        ~odrive_shm_client();
+        int open(const std::string& name); // Map segment created by the daemon
+        void close(void);
+
+        int getChannel(const std::string& name); // Channel index, -1 if not published
+        int readFrame(std::vector<uint64_t>& values, int64_t *timestamp = NULL); // Consistent copy of all channels
+        template<typename T>
+            int read(int channel, T& value, int64_t *timestamp = NULL); // Latest value of one channel
+        template<typename T>
+            int sendCommand(const std::string& object, const T& value); // Queue write, never blocks
+
+    private:
+        odrive_shm_segment *segment_ = NULL;
+    };
+}
+#endif
@@ -0,0 +1,79 @@
+#ifndef ODRIVE_SUBSCRIBE_H
+#define ODRIVE_SUBSCRIBE_H
+
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include "odrive.h"
+
+// Subscription polling
+#define ODRIVE_SUBSCRIBE_MIN_INTERVAL               1000000LL /* ns, fastest poll of a changing value */
+#define ODRIVE_SUBSCRIBE_MAX_INTERVAL               100000000LL /* ns, slowest poll of a quiet value */
+
+namespace dhr{
+    typedef std::function<bool(double notified, double value)> odrive_change_predicate; // Significant change
+    typedef std::function<void(int subscription, double value)> odrive_change_callback;
+
+    typedef struct _odrive_subscription_stats {
+        uint64_t samples = 0;           // reads of the value
+        uint64_t notifications = 0;     // callbacks
+        uint64_t errors = 0;            // failed reads
+        int64_t interval_ns = 0;        // current poll interval
+        double value = 0;               // last sample
+    } odrive_subscription_stats;
+
+    /*
+     * Polls subscribed values and calls back on significant change
+     * Due values are read in one pipelined batch per pass. A value that
+     * moved since its previous sample is polled twice as often, down to
+     * the minimum interval; a quiet one half as often, up to the maximum.
+     * Callbacks run on the poller thread without locks held.
+     */
+    class odrive_subscriber {
+    public:
+        odrive_subscriber(odrive *endpoint, const Json::Value& odrive_json,
+            int64_t min_interval_ns = ODRIVE_SUBSCRIBE_MIN_INTERVAL,
+            int64_t max_interval_ns = ODRIVE_SUBSCRIBE_MAX_INTERVAL);
+        ~odrive_subscriber();
+        int subscribe(const std::string& name, double deadband,
+            odrive_change_callback callback); // Subscription index, -1 on error
+        int subscribe(const std::string& name, odrive_change_predicate predicate,
+            odrive_change_callback callback); // Subscription index, -1 on error
+        void unsubscribe(int subscription);
+
+        int poll(int64_t *next_ns = NULL); // Read due values and notify
+        int start(void); // Poll on a thread
+        void stop(void);
+
+        odrive_subscription_stats getStats(int subscription);
+
+    private:
+        typedef struct _subscription {
+            odrive_object object;
+            double deadband;
+            odrive_change_predicate predicate;  // overrides deadband when set
+            odrive_change_callback callback;
+            bool active;
+            bool sampled;
+            double notified;                    // value of the last callback
+            int64_t next_ns;                    // monotonic time of next sample
+            odrive_subscription_stats stats;
+        } subscription;
+
+        int add(const std::string& name, double deadband, odrive_change_predicate predicate,
+            odrive_change_callback callback);
+        int64_t nextDue(int64_t now); // Earliest next sample, called with lock_ held
+        void run(void);
+
+        odrive *endpoint_;
+        Json::Value odrive_json_;
+        int64_t min_interval_ns_;
+        int64_t max_interval_ns_;
+        std::vector<subscription> subscriptions_;
+        std::mutex lock_; // subscriptions
+        std::condition_variable wake_;
+        std::thread thread_;
+        bool running_ = false;
+    };
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef ODRIVE_TRACE_H
+#define ODRIVE_TRACE_H
+
+#include <atomic>
+#include "odrive.h"
+
+// Trace file
+#define ODRIVE_TRACE_MAGIC                          0x5254444f /* "ODTR" */
+#define ODRIVE_TRACE_VERSION                        1
+#define ODRIVE_TRACE_CAPACITY                       65536 /* Records, power of two */
+
+// Trace record types
+#define ODRIVE_TRACE_OUT                            0 /* OUT packet submitted */
+#define ODRIVE_TRACE_OUT_DONE                       1 /* OUT packet accepted by target */
+#define ODRIVE_TRACE_IN                             2 /* IN packet received */
+#define ODRIVE_TRACE_ERROR                          3 /* Request failed */
+
+namespace dhr{
+    typedef struct _odrive_trace_header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t record_size;
+        uint16_t json_crc;      // json the endpoint IDs belong to
+        uint16_t reserved;
+    } odrive_trace_header;
+
+    typedef struct _odrive_trace_record {
+        int64_t timestamp_ns;   // monotonic clock
+        uint16_t seq_no;
+        uint16_t endpoint_id;   // with acknowledge bit
+        uint16_t length;        // packet size
+        uint8_t type;           // ODRIVE_TRACE_*
+        uint8_t status;         // negated libusb error for ODRIVE_TRACE_ERROR
+    } odrive_trace_record;
+
+    /*
+     * Preallocated ring of protocol packets
+     * Recorded by one odrive object under its ep_lock, flushed from any
+     * other thread. Records the flush could not keep up with are counted
+     * as dropped.
+     */
+    class odrive_tracer {
+    public:
+        odrive_tracer(size_t capacity = ODRIVE_TRACE_CAPACITY);
+        ~odrive_tracer();
+        int open(const std::string& path, uint16_t json_crc); // Start trace file
+        void close(void);
+        int flush(void); // Write records recorded since last flush
+        uint64_t getDropped(void);
+
+        /**
+         *
+         * Record packet, the only call on the USB path
+         * @param type ODRIVE_TRACE_* type
+         * @param seq_no packet sequence number
+         * @param endpoint_id odrive ID
+         * @param length packet size
+         * @param timestamp_ns monotonic time of the event
+         * @param status libusb error of ODRIVE_TRACE_ERROR
+         *
+         */
+        void record(uint8_t type, uint16_t seq_no, uint16_t endpoint_id, uint16_t length,
+            int64_t timestamp_ns, int status = 0)
+        {
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            odrive_trace_record& r = records_[head & mask_];
+            r.timestamp_ns = timestamp_ns;
+            r.seq_no = seq_no;
+            r.endpoint_id = endpoint_id;
+            r.length = length;
+            r.type = type;
+            r.status = -status;
+            head_.store(head + 1, std::memory_order_release);
+        }
+
+    private:
+        std::vector<odrive_trace_record> records_;
+        std::vector<odrive_trace_record> staging_;
+        size_t mask_;
+        std::atomic<uint64_t> head_;
+        uint64_t tail_ = 0;
+        uint64_t dropped_ = 0;
+        FILE *file_ = NULL;
+        std::mutex flush_lock_;
+    };
+}
+#endif
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "odrive_aggregate.h"
+
+typedef void (*aggregate_kernel)(const float *, int, dhr::odrive_aggregate *);
+
+/*
+ * Reduce every window of every channel, return ns per sample
+ */
+static double runKernel(aggregate_kernel kernel, const std::vector<float>& samples,
+        int channels, int frames, int window, std::vector<dhr::odrive_aggregate>& results){
+        auto start = std::chrono::steady_clock::now();
+        for (int channel = 0; channel < channels; channel++) {
+            const float *block = &samples[(size_t)channel * frames];
+            for (int first = 0; first + window <= frames; first += window) {
+                kernel(block + first, window, &results[(size_t)channel * (frames / window) + first / window]);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / ((double)channels * frames);
+}
+
+int main(int argc, char **argv){
+        //Default: 6 boards, 2 axes x (vel_estimate, Iq_measured, pos_estimate) + vbus_voltage
+        int boards = argc > 1 ? atoi(argv[1]) : 6;
+        int rate = argc > 2 ? atoi(argv[2]) : 1000;
+        int window = argc > 3 ? atoi(argv[3]) : 100;
+        int seconds = 10;
+        if (boards <= 0 || rate <= 0 || window <= 0 || window > rate * seconds) {
+            printf("Usage: %s [boards] [rate_hz] [window], all positive, window up to %d s of samples\n",
+                   argv[0], seconds);
+            return 1;
+        }
+        int channels = boards * 7;
+        int frames = rate * seconds;
+
+        //Channel major samples, the layout odrive_aggregator keeps per window
+        std::vector<float> samples((size_t)channels * frames);
+        for (int channel = 0; channel < channels; channel++) {
+            for (int i = 0; i < frames; i++) {
+                samples[(size_t)channel * frames + i] = std::sin(i * 0.01f + channel) * 10 + (rand() % 100) * 0.01f;
+            }
+        }
+
+        std::vector<dhr::odrive_aggregate> scalar((size_t)channels * (frames / window));
+        std::vector<dhr::odrive_aggregate> vector(scalar.size());
+        double scalar_ns = 1e30, vector_ns = 1e30;
+        for (int run = 0; run < 5; run++) {
+            scalar_ns = std::min(scalar_ns, runKernel(dhr::aggregateScalar, samples, channels, frames, window, scalar));
+            vector_ns = std::min(vector_ns, runKernel(dhr::aggregateVector, samples, channels, frames, window, vector));
+        }
+
+        float max_error = 0;
+        for (size_t i = 0; i < scalar.size(); i++) {
+            max_error = std::max(max_error, std::fabs(scalar[i].mean - vector[i].mean));
+            max_error = std::max(max_error, std::fabs(scalar[i].rms - vector[i].rms));
+            if (scalar[i].min != vector[i].min || scalar[i].max != vector[i].max) {
+                max_error = INFINITY;
+            }
+        }
+
+        //Whole stage: frames pushed one by one as they are polled
+        dhr::odrive_aggregator aggregator(channels, window);
+        std::vector<float> frame(channels);
+        int results = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            for (int channel = 0; channel < channels; channel++) {
+                frame[channel] = samples[(size_t)channel * frames + i];
+            }
+            results += aggregator.push(frame.data());
+        }
+        double push_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+
+        printf("%d channels at %d Hz, window %d (%d Hz out), %d s of samples\n",
+               channels, rate, window, rate / window, seconds);
+        printf("scalar kernel:     %6.3f ns/sample\n", scalar_ns);
+        printf("vector kernel:     %6.3f ns/sample (%.2fx)\n", vector_ns, scalar_ns / vector_ns);
+        printf("max difference:    %g\n", max_error);
+        printf("aggregator push:   %6.1f ns/frame, %d windows, %.4f%% of one core\n",
+               push_ns, results, push_ns * rate / 1e7);
+        return 0;
+}
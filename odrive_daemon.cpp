@@ -0,0 +1,92 @@
+#include <memory>
+#include <signal.h>
+#include <time.h>
+#include "odrive_shm.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int){
+        running = 0;
+}
+
+static void usage(const char *program){
+        std::cout << "Usage: " << program << " -s serial [-n /shm_name] [-s serial -n /shm_name]... [-r rate_hz] channel..." << std::endl;
+        std::cout << "  e.g. " << program << " -s 2075378E5753 -n /odrive0 -r 500"
+                  << " axis0.encoder.vel_estimate axis0.motor.current_control.Iq_measured vbus_voltage" << std::endl;
+        std::cout << "  Every -s adds a board published under the matching -n, the channels are the same for all" << std::endl;
+}
+
+int main(int argc, char **argv){
+        std::vector<uint64_t> serial_numbers;
+        std::vector<std::string> shm_names;
+        int rate = 100;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "s:n:r:h")) != -1) {
+            switch (opt) {
+            case 's': serial_numbers.push_back(strtoull(optarg, NULL, 16)); break;
+            case 'n': shm_names.push_back(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+            }
+        }
+        if (serial_numbers.size() == 1 && shm_names.empty()) {
+            shm_names.push_back("/odrive");
+        }
+        std::vector<std::string> channels(argv + optind, argv + argc);
+        if (serial_numbers.empty() || shm_names.size() != serial_numbers.size() ||
+                rate <= 0 || channels.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        //The daemon is the only process claiming the odrives, one segment per board
+        std::vector<std::unique_ptr<dhr::odrive>> boards;
+        std::vector<std::unique_ptr<dhr::odrive_shm_server>> servers;
+        for (size_t i = 0; i < serial_numbers.size(); i++) {
+            if (serial_numbers[i] == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            boards.emplace_back(new dhr::odrive());
+            if (boards[i]->init(serial_numbers[i]) != ODRIVE_OK) {
+                std::cout << "ODrive not found: " << std::hex << serial_numbers[i] << std::endl;
+                return 1;
+            }
+            Json::Value json;
+            if (dhr::getJsonCached(boards[i].get(), &json) != 0) {
+                return 1;
+            }
+            servers.emplace_back(new dhr::odrive_shm_server());
+            if (servers[i]->open(shm_names[i], boards[i].get(), json, channels) != ODRIVE_OK) {
+                return 1;
+            }
+        }
+
+        signal(SIGINT, stop);
+        signal(SIGTERM, stop);
+
+        //Run commands, then publish a frame, once per period
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        long period_ns = 1000000000L / rate;
+        while (running) {
+            for (size_t i = 0; i < servers.size(); i++) {
+                servers[i]->processCommands();
+                servers[i]->publish();
+            }
+
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        for (size_t i = 0; i < servers.size(); i++) {
+            servers[i]->close();
+            boards[i]->close();
+        }
+        return 0;
+}
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include "odrive_config.h"
+
+/*
+ * Time short reads while two threads download the json and configuration
+ * snapshots in a loop, return mean and max ns per read
+ */
+static void runProbe(dhr::odrive *od, const Json::Value& json, int probe_priority, int reads,
+        double *mean_ns, int64_t *max_ns){
+        std::atomic<bool> running(true);
+        auto bulk = [&]{
+            while (running) {
+                Json::Value downloaded;
+                dhr::getJson(od, &downloaded);
+                dhr::odrive_snapshot snapshot;
+                dhr::takeConfigSnapshot(od, json, snapshot);
+            }
+        };
+        std::thread bulk0(bulk), bulk1(bulk);
+
+        int64_t sum = 0;
+        *max_ns = 0;
+        {
+            dhr::odrive_priority_scope probe(probe_priority);
+            for (int i = 0; i < reads; i++) {
+                float vbus;
+                int64_t start = dhr::getMonotonicTime();
+                dhr::readOdriveData(od, json, "vbus_voltage", vbus);
+                int64_t duration = dhr::getMonotonicTime() - start;
+                sum += duration;
+                *max_ns = std::max(*max_ns, duration);
+                usleep(1000);
+            }
+        }
+
+        running = false;
+        bulk0.join();
+        bulk1.join();
+        *mean_ns = (double)sum / reads;
+}
+
+int main(int argc, char **argv){
+        if (argc < 2) {
+            printf("Usage: %s serial [reads]\n", argv[0]);
+            return 1;
+        }
+        uint64_t serial_number = strtoull(argv[1], NULL, 16);
+        int reads = argc > 2 ? atoi(argv[2]) : 1000;
+        if (serial_number == 0 || reads <= 0) {
+            printf("Usage: %s serial [reads], reads positive\n", argv[0]);
+            return 1;
+        }
+
+        //Reads only, safe on an armed axis
+        dhr::odrive od;
+        if (od.init(serial_number) != ODRIVE_OK) {
+            printf("ODrive not found\n");
+            return 1;
+        }
+        Json::Value json;
+        if (dhr::getJson(&od, &json) != 0) {
+            return 1;
+        }
+
+        //Each run changes one factor: the cap, then the probe class
+        double fifo_mean, capped_mean, classes_mean;
+        int64_t fifo_max, capped_max, classes_max;
+
+        //Same class, no cap: requests are served in arrival order
+        od.setBulkRate(0);
+        runProbe(&od, json, ODRIVE_PRIORITY_BULK, reads, &fifo_mean, &fifo_max);
+
+        //Same class, capped: the probe competes for the same tokens
+        od.setBulkRate(ODRIVE_BULK_RATE);
+        runProbe(&od, json, ODRIVE_PRIORITY_BULK, reads, &capped_mean, &capped_max);
+
+        //Real-time probe, same cap: only the class differs from the run above
+        runProbe(&od, json, ODRIVE_PRIORITY_REALTIME, reads, &classes_mean, &classes_max);
+
+        printf("%d reads against 2 bulk threads\n", reads);
+        printf("single class:            mean %8.1f us, max %8.1f us\n", fifo_mean / 1000, fifo_max / 1000.0);
+        printf("single class, capped:    mean %8.1f us, max %8.1f us (cap)\n", capped_mean / 1000, capped_max / 1000.0);
+        printf("real-time class, capped: mean %8.1f us, max %8.1f us (class)\n", classes_mean / 1000, classes_max / 1000.0);
+        for (int p = 0; p < ODRIVE_PRIORITY_COUNT; p++) {
+            dhr::odrive_dispatch_stats stats = od.getDispatchStats(p);
+            printf("class %d: %llu requests, wait mean %.1f us, max %.1f us\n", p,
+                   (unsigned long long)stats.requests, stats.wait_ns_mean / 1000, stats.wait_ns_max / 1000.0);
+        }
+
+        od.close();
+        return 0;
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include "odrive_trace.h"
+
+typedef struct _request_trace {
+        int64_t submitted_ns;
+        int64_t accepted_ns;
+} request_trace;
+
+typedef struct _endpoint_stats {
+        uint64_t errors = 0;
+        std::vector<int64_t> transfer_ns;   // OUT submitted to accepted by target
+        std::vector<int64_t> response_ns;   // OUT accepted to IN received
+        std::vector<int64_t> total_ns;      // OUT submitted to IN received
+} endpoint_stats;
+
+/*
+ * Map every endpoint ID of the target json to its full name
+ */
+static void collectNames(const Json::Value& members, const std::string& prefix,
+        std::map<int, std::string>& names){
+        for (Json::Value::ArrayIndex i = 0; i < members.size(); i++) {
+            const Json::Value& member = members[i];
+            std::string name = prefix + member["name"].asString();
+            if (member.isMember("id")) {
+                names[member["id"].asInt()] = name;
+            }
+            collectNames(member["members"], name + ".", names);
+            collectNames(member["inputs"], name + ".", names);
+            collectNames(member["outputs"], name + ".", names);
+        }
+}
+
+/*
+ * CRC16 of the json text as computed by the target, see dhr::calcCrc16
+ */
+static uint16_t jsonCrc(const std::string& text){
+        uint16_t crc = ODRIVE_PROTOCOL_VERSION;
+        for (unsigned char c : text) {
+            crc ^= (uint16_t)c << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ ODRIVE_CRC16_POLYNOMIAL) : (uint16_t)(crc << 1);
+            }
+        }
+        return crc;
+}
+
+static double percentile(std::vector<int64_t>& values, double p){
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[std::min<size_t>(values.size() - 1, p * values.size())] / 1000.0;
+}
+
+static double mean(const std::vector<int64_t>& values){
+        double sum = 0;
+        for (int64_t value : values) {
+            sum += value;
+        }
+        return values.empty() ? 0 : sum / values.size() / 1000.0;
+}
+
+int main(int argc, char **argv){
+        if (argc < 2) {
+            std::cout << "Usage: " << argv[0] << " trace.bin [odrive.json]" << std::endl;
+            return 1;
+        }
+
+        std::ifstream trace(argv[1], std::ios::binary);
+        dhr::odrive_trace_header header;
+        if (!trace.read((char *)&header, sizeof(header)) || le32toh(header.magic) != ODRIVE_TRACE_MAGIC ||
+                le16toh(header.record_size) != sizeof(dhr::odrive_trace_record)) {
+            std::cout << "Not a trace file: " << argv[1] << std::endl;
+            return 1;
+        }
+
+        //Endpoint IDs only mean something in the json they were traced with
+        std::map<int, std::string> names;
+        uint16_t trace_crc = le16toh(header.json_crc);
+        if (argc > 2) {
+            std::ifstream file(argv[2], std::ios::binary);
+            std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            Json::Value json;
+            Json::Reader reader;
+            if (!reader.parse(text, json)) {
+                std::cout << "Error parsing json: " << argv[2] << std::endl;
+                return 1;
+            }
+            if (jsonCrc(text) != trace_crc) {
+                printf("Warning: json crc 0x%04x does not match trace 0x%04x, showing endpoint IDs\n",
+                       jsonCrc(text), trace_crc);
+            } else {
+                collectNames(json, "", names);
+            }
+        }
+
+        //Pair the records of each request by sequence number
+        std::map<uint16_t, request_trace> pending;
+        std::map<int, endpoint_stats> stats;
+        dhr::odrive_trace_record record;
+        uint64_t records = 0;
+        int64_t first_ns = 0, last_ns = 0;
+        while (trace.read((char *)&record, sizeof(record))) {
+            record.timestamp_ns = (int64_t)le64toh((uint64_t)record.timestamp_ns);
+            record.seq_no = le16toh(record.seq_no);
+            record.endpoint_id = le16toh(record.endpoint_id);
+            record.length = le16toh(record.length);
+            int id = record.endpoint_id & 0x7fff;
+            bool ack = record.endpoint_id & 0x8000;
+            if (records++ == 0) {
+                first_ns = record.timestamp_ns;
+            }
+            last_ns = std::max(last_ns, record.timestamp_ns);
+
+            switch (record.type) {
+            case ODRIVE_TRACE_OUT:
+                pending[record.seq_no] = { record.timestamp_ns, 0 };
+                break;
+            case ODRIVE_TRACE_OUT_DONE:
+                if (pending.count(record.seq_no)) {
+                    request_trace& request = pending[record.seq_no];
+                    request.accepted_ns = record.timestamp_ns;
+                    stats[id].transfer_ns.push_back(request.accepted_ns - request.submitted_ns);
+                    if (!ack) {
+                        stats[id].total_ns.push_back(request.accepted_ns - request.submitted_ns);
+                        pending.erase(record.seq_no);
+                    }
+                }
+                break;
+            case ODRIVE_TRACE_IN:
+                if (pending.count(record.seq_no)) {
+                    request_trace& request = pending[record.seq_no];
+                    if (request.accepted_ns) {
+                        stats[id].response_ns.push_back(record.timestamp_ns - request.accepted_ns);
+                    }
+                    stats[id].total_ns.push_back(record.timestamp_ns - request.submitted_ns);
+                    pending.erase(record.seq_no);
+                }
+                break;
+            default:
+                stats[id].errors++;
+                pending.erase(record.seq_no);
+                break;
+            }
+        }
+
+        printf("%llu records over %.3f s, json crc 0x%04x\n", (unsigned long long)records,
+               (last_ns - first_ns) / 1e9, trace_crc);
+        printf("%-48s %8s %6s %9s %9s %9s %9s %9s\n", "endpoint", "requests", "errors",
+               "tx us", "rx us", "p50 us", "p99 us", "max us");
+        for (std::pair<const int, endpoint_stats>& entry : stats) {
+            std::string name = names.count(entry.first) ? names[entry.first] : std::to_string(entry.first);
+            endpoint_stats& s = entry.second;
+            printf("%-48s %8zu %6llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name.c_str(), s.total_ns.size(),
+                   (unsigned long long)s.errors, mean(s.transfer_ns), mean(s.response_ns),
+                   percentile(s.total_ns, 0.5), percentile(s.total_ns, 0.99), percentile(s.total_ns, 1.0));
+        }
+        return 0;
+}
@@ -1,4 +1,6 @@
 #include "odrive.h"
+#include "odrive_trace.h"
+#include <thread>
 
 /*
  * Constructor
@@ -6,8 +8,9 @@
  */
 
 dhr::odrive::odrive(){
+		logStart();
 		if(libusb_init(&libusb_context_) != LIBUSB_SUCCESS){
-				std::cout << "Error occurred while initializing USB" << std::endl;
+				ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error occurred while initializing USB");
 		}
 }
 
@@ -17,12 +20,195 @@ dhr::odrive::odrive(){
  */
 
 dhr::odrive::~odrive(){
+		for (libusb_transfer *transfer : out_transfers_) {
+				libusb_free_transfer(transfer);
+		}
+		for (libusb_transfer *transfer : in_transfers_) {
+				libusb_free_transfer(transfer);
+		}
 		if(libusb_context_ != NULL){
 				libusb_exit(libusb_context_);
 				libusb_context_ = NULL;
 		}
 }
 
+static thread_local int request_priority = ODRIVE_PRIORITY_NORMAL;
+
+/**
+ *
+ * Priority class of the calling thread
+ * @return ODRIVE_PRIORITY_* class, ODRIVE_PRIORITY_NORMAL unless set
+ *
+ */
+int dhr::getRequestPriority(void)
+{
+    return request_priority;
+}
+
+/**
+ *
+ * Set priority class of the calling thread's requests
+ * @param priority ODRIVE_PRIORITY_* class
+ *
+ */
+void dhr::setRequestPriority(int priority)
+{
+    request_priority = std::max(0, std::min(priority, ODRIVE_PRIORITY_COUNT - 1));
+}
+
+/*
+ * Constructor
+ * @param priority ODRIVE_PRIORITY_* class until the end of the scope
+ */
+
+dhr::odrive_priority_scope::odrive_priority_scope(int priority) : previous_(getRequestPriority()){
+		setRequestPriority(priority);
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_priority_scope::~odrive_priority_scope(){
+		setRequestPriority(previous_);
+}
+
+/*
+ * Constructor
+ *
+ */
+
+dhr::odrive_dispatch_lock::odrive_dispatch_lock()
+    : bulk_rate_(ODRIVE_BULK_RATE), bulk_tokens_(ODRIVE_PIPELINE_DEPTH),
+      bulk_refill_ns_(getMonotonicTime()){
+}
+
+/**
+ *
+ * Take bulk tokens for requests
+ * The bucket holds one pipeline window, so bulk batches keep their
+ * pipelining while their average rate is capped. A batch longer than a
+ * window waits for a full bucket and leaves it in debt for the rest.
+ * Must be called with lock_ held
+ * @param requests requests about to be sent
+ * @param now monotonic time
+ * @param wait_ns time until enough tokens are available
+ * @return true if the tokens were taken
+ *
+ */
+bool dhr::odrive_dispatch_lock::bulkReady(int requests, int64_t now, int64_t *wait_ns)
+{
+    if (bulk_rate_ <= 0) {
+        return true;
+    }
+
+    double burst = ODRIVE_PIPELINE_DEPTH;
+    double cost = std::min<double>(requests, burst);
+    bulk_tokens_ = std::min(burst, bulk_tokens_ + (now - bulk_refill_ns_) * 1e-9 * bulk_rate_);
+    bulk_refill_ns_ = now;
+
+    if (bulk_tokens_ >= cost) {
+        bulk_tokens_ -= requests;
+        return true;
+    }
+    *wait_ns = (int64_t)((cost - bulk_tokens_) * 1e9 / bulk_rate_) + 1;
+    return false;
+}
+
+/**
+ *
+ * Wait for the endpoint at the priority class of the calling thread
+ * @param requests requests sent while holding the lock
+ *
+ */
+void dhr::odrive_dispatch_lock::lock(int requests)
+{
+    int priority = getRequestPriority();
+    int64_t start = getMonotonicTime();
+
+    std::unique_lock<std::mutex> lock(lock_);
+    uint64_t ticket = next_ticket_[priority]++;
+    waiting_[priority]++;
+
+    while (true) {
+        bool blocked = held_ || ticket != serving_[priority];
+        for (int p = 0; p < priority && !blocked; p++) {
+            blocked = waiting_[p] > 0;
+        }
+
+        int64_t wait_ns = 0;
+        if (!blocked && (priority != ODRIVE_PRIORITY_BULK ||
+                bulkReady(requests, getMonotonicTime(), &wait_ns))) {
+            break;
+        }
+        if (wait_ns) {
+            ready_[priority].wait_for(lock, std::chrono::nanoseconds(wait_ns));
+        } else {
+            ready_[priority].wait(lock);
+        }
+    }
+
+    waiting_[priority]--;
+    serving_[priority]++;
+    held_ = true;
+
+    int64_t wait = getMonotonicTime() - start;
+    odrive_dispatch_stats& stats = stats_[priority];
+    stats.requests += requests;
+    stats.wait_ns_max = std::max(stats.wait_ns_max, wait);
+    if (stats.requests > 0) {
+        stats.wait_ns_mean += (wait - stats.wait_ns_mean) * requests / stats.requests;
+    }
+}
+
+/**
+ *
+ * Release the endpoint to the highest waiting class
+ *
+ */
+void dhr::odrive_dispatch_lock::unlock(void)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    held_ = false;
+
+    for (int p = 0; p < ODRIVE_PRIORITY_COUNT; p++) {
+        if (waiting_[p]) {
+            ready_[p].notify_all();
+            break;
+        }
+    }
+}
+
+/**
+ *
+ * Cap bulk priority requests
+ * @param requests_per_second average bulk rate, 0 for no cap
+ *
+ */
+void dhr::odrive_dispatch_lock::setBulkRate(int requests_per_second)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    bulk_rate_ = requests_per_second;
+    ready_[ODRIVE_PRIORITY_BULK].notify_all();
+}
+
+/**
+ *
+ * Wait for the endpoint of a priority class
+ * @param priority ODRIVE_PRIORITY_* class
+ * @return copy of the metrics
+ *
+ */
+dhr::odrive_dispatch_stats dhr::odrive_dispatch_lock::getStats(int priority)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (priority < 0 || priority >= ODRIVE_PRIORITY_COUNT) {
+        return odrive_dispatch_stats();
+    }
+    return stats_[priority];
+}
+
 /**
  *
  * Append short data to data buffer
@@ -96,7 +282,7 @@ commBuffer dhr::odrive::createODrivePacket(short seq_no, int endpoint_id,
         crc = ODRIVE_PROTOCOL_VERSION;
     }
     else {
-        crc = ODRIVE_DEFAULT_CRC_VALUE;
+        crc = json_crc_.load(std::memory_order_relaxed);
     }
 
     appendShortToCommBuffer(packet, seq_no);
@@ -115,6 +301,20 @@ commBuffer dhr::odrive::createODrivePacket(short seq_no, int endpoint_id,
     return packet;
 }
 
+/**
+ *
+ * Advance outbound sequence number
+ * Must be called with ep_lock held
+ * @return sequence number for the next packet
+ *
+ */
+short dhr::odrive::nextSeqNo(void)
+{
+    outbound_seq_no_ = (outbound_seq_no_ + 1) & 0x7fff;
+    outbound_seq_no_ |= LIBUSB_ENDPOINT_IN;
+    return outbound_seq_no_;
+}
+
 /**
  *
  *  Read value from ODrive
@@ -157,7 +357,7 @@ int dhr::odrive::execFunc(int endpoint_id)
 
     status = endpointRequest(endpoint_id, rx, rx_length, tx, 1, 0);
     if (status != LIBUSB_SUCCESS) {
-			std::cout << "* execFunc: Error in endpoint request" << std::to_string(endpoint_id) << std::endl;
+			ODRIVE_LOG_VALUE(ODRIVE_LOG_ERROR, "execFunc: Error in endpoint request", endpoint_id);
     }
     return status;
 }
@@ -196,12 +396,13 @@ int dhr::odrive::setData(int endpoint_id, const TT& value)
  * @param length data length
  * @param read send read address
  * @param address read address
+ * @param timeout transfer timeout in milliseconds
  * @return LIBUSB_SUCCESS on success
  *
  */
 int dhr::odrive::endpointRequest(int endpoint_id, commBuffer& received_payload,
     	int& received_length, commBuffer payload,
-    	bool ack, int length, bool read, int address)
+    	bool ack, int length, bool read, int address, unsigned int timeout)
 {
     commBuffer send_buffer;
     commBuffer receive_buffer;
@@ -211,61 +412,684 @@ int dhr::odrive::endpointRequest(int endpoint_id, commBuffer& received_payload,
     short received_seq_no = 0;
 
     ep_lock.lock();
+    odrive_tracer *tracer = pinTracer();
 
     // Prepare sequence number
     if (ack) {
         endpoint_id |= 0x8000;
     }
-    outbound_seq_no_ = (outbound_seq_no_ + 1) & 0x7fff;
-    outbound_seq_no_ |= LIBUSB_ENDPOINT_IN;
-    short seq_no = outbound_seq_no_;
+    short seq_no = nextSeqNo();
 
     // Create request packet
     commBuffer packet = createODrivePacket(seq_no, endpoint_id, length, read, address, payload);
 
     // Transfer paket to target
+    trace(tracer, ODRIVE_TRACE_OUT, seq_no, endpoint_id, packet.size());
     int result = libusb_bulk_transfer(odrive_handle_, ODRIVE_OUT_EP,
-    	    packet.data(), packet.size(), &sent_bytes, ODRIVE_TIMEOUT);
+    	    packet.data(), packet.size(), &sent_bytes, timeout);
+    trace(tracer, result == LIBUSB_SUCCESS ? ODRIVE_TRACE_OUT_DONE : ODRIVE_TRACE_ERROR,
+            seq_no, endpoint_id, sent_bytes, result);
     if (result != LIBUSB_SUCCESS) {
-			std:: cout << "* Error in transfering data to USB!" << std::endl;
+			ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in transfering data to USB!");
+        unpinTracer(tracer);
         ep_lock.unlock();
         return result;
     } else if (packet.size() != sent_bytes) {
-			std::cout << "* Error in transfering data to USB, not all data transferred!" << std::endl;
+			ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error in transfering data to USB, not all data transferred!");
+
+    }
+
+    // Get responce
+    if (ack) {
+        result = libusb_bulk_transfer(odrive_handle_, ODRIVE_IN_EP,
+    		receive_bytes, ODRIVE_MAX_BYTES_TO_RECEIVE,
+    		&received_bytes, timeout);
+        trace(tracer, result == LIBUSB_SUCCESS ? ODRIVE_TRACE_IN : ODRIVE_TRACE_ERROR,
+                seq_no, endpoint_id, received_bytes, result);
+        if (result != LIBUSB_SUCCESS) {
+		    ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in reading data from USB!");
+            unpinTracer(tracer);
+            ep_lock.unlock();
+            return result;
+        }
+
+        // Push recevived data to buffer
+        for (int i = 0; i < received_bytes; i++) {
+            receive_buffer.push_back(receive_bytes[i]);
+        }
+
+        received_payload = decodeODrivePacket(receive_buffer, received_seq_no, receive_buffer);
+        if (received_seq_no != seq_no) {
+				ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error Received data out of order");
+        }
+        received_length = received_payload.size();
+
+    }
+
+    unpinTracer(tracer);
+    ep_lock.unlock();
+
+    return LIBUSB_SUCCESS;
+}
+
+
+
+/**
+ *
+ * Transfer completion callback used by the request pipeline
+ * @param transfer completed transfer, user_data points to the odrive
+ *
+ */
+void LIBUSB_CALL dhr::odrive::pipelineTransferDone(struct libusb_transfer *transfer)
+{
+    odrive *od = (odrive *)transfer->user_data;
+    pipeline_window& window = od->window_;
+
+    for (int i = 0; i < window.count; i++) {
+        if (od->out_transfers_[i] == transfer) {
+            window.sent_ns[i] = getMonotonicTime();
+        } else if (od->in_transfers_[i] == transfer) {
+            window.received_ns[i] = getMonotonicTime();
+        }
+    }
+    window.pending--;
+}
+
+/**
+ *
+ * Encode a window of requests and submit its IN transfers
+ * IN transfers go ahead of the OUT transfers so that each response is
+ * drained as soon as the target produces it, letting the target accept
+ * the next queued request without a host round trip.
+ * Must be called with ep_lock held
+ * @param requests first request of the window
+ * @param count number of requests, at most ODRIVE_PIPELINE_DEPTH
+ * @return LIBUSB_SUCCESS on success
+ *
+ */
+int dhr::odrive::pipelinePrepare(odrive_request *requests, int count)
+{
+    pipeline_window& window = window_;
+
+    window.requests = requests;
+    window.count = count;
+    window.acks = 0;
+    window.sent = 0;
+    window.pending = 0;
+    window.status = LIBUSB_SUCCESS;
+
+    while ((int)out_transfers_.size() < count) {
+        out_transfers_.push_back(libusb_alloc_transfer(0));
+        in_transfers_.push_back(libusb_alloc_transfer(0));
+    }
+
+    // Encode every packet of the window before the first transfer starts
+    for (int i = 0; i < count; i++) {
+        odrive_request& request = requests[i];
+        int endpoint_id = request.endpoint_id;
+        if (request.ack) {
+            endpoint_id |= 0x8000;
+        }
+        window.seq_nos[i] = nextSeqNo();
+        window.packets[i] = createODrivePacket(window.seq_nos[i], endpoint_id, request.length,
+                        request.read, request.address, request.payload);
+        window.sent_ns[i] = 0;
+        window.received_ns[i] = 0;
+        request.received_payload.clear();
+        request.status = LIBUSB_SUCCESS;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!requests[i].ack) {
+            continue;
+        }
+        libusb_fill_bulk_transfer(in_transfers_[window.acks], odrive_handle_, ODRIVE_IN_EP,
+                window.received[window.acks], ODRIVE_MAX_BYTES_TO_RECEIVE,
+                pipelineTransferDone, this, ODRIVE_TIMEOUT);
+        if ((window.status = libusb_submit_transfer(in_transfers_[window.acks])) != LIBUSB_SUCCESS) {
+            pipelineCancel();
+            return window.status;
+        }
+        window.pending++;
+        window.acks++;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+/**
+ *
+ * Submit the OUT transfers of the prepared window
+ * Must be called with ep_lock held
+ * @return LIBUSB_SUCCESS on success
+ *
+ */
+int dhr::odrive::pipelineStart(void)
+{
+    pipeline_window& window = window_;
+    odrive_tracer *tracer = pinTracer();
+
+    for (int i = 0; i < window.count && window.status == LIBUSB_SUCCESS; i++) {
+        libusb_fill_bulk_transfer(out_transfers_[i], odrive_handle_, ODRIVE_OUT_EP,
+                window.packets[i].data(), window.packets[i].size(),
+                pipelineTransferDone, this, ODRIVE_TIMEOUT);
+        trace(tracer, ODRIVE_TRACE_OUT, window.seq_nos[i], window.packets[i][2] |
+                (window.packets[i][3] << 8), window.packets[i].size());
+        if ((window.status = libusb_submit_transfer(out_transfers_[i])) != LIBUSB_SUCCESS) {
+            pipelineCancel();
+            break;
+        }
+        window.pending++;
+        window.sent++;
+    }
+
+    unpinTracer(tracer);
+    return window.status;
+}
+
+/**
+ *
+ * Cancel the IN transfers after a failed submission
+ * Nothing will answer them once a request could not be sent
+ * Must be called with ep_lock held
+ *
+ */
+void dhr::odrive::pipelineCancel(void)
+{
+    ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in submitting transfer to USB!");
+    for (int i = 0; i < window_.acks; i++) {
+        libusb_cancel_transfer(in_transfers_[i]);
+    }
+}
+
+/**
+ *
+ * Handle USB events of the window
+ * Must be called with ep_lock held
+ * @param tv time to wait for events
+ * @return true while transfers are outstanding
+ *
+ */
+bool dhr::odrive::pipelinePoll(struct timeval *tv)
+{
+    if (window_.pending <= 0) {
+        return false;
+    }
+    int result = libusb_handle_events_timeout_completed(libusb_context_, tv, NULL);
+    if (result != LIBUSB_SUCCESS && result != LIBUSB_ERROR_INTERRUPTED) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in handling USB events!");
+        window_.status = result;
+        return false;
+    }
+    return window_.pending > 0;
+}
+
+/**
+ *
+ * Record the completions of one request of the window
+ * Must be called with ep_lock held
+ * @param tracer pinned tracer
+ * @param index request index in the window
+ * @param ack index of its IN transfer
+ *
+ */
+void dhr::odrive::pipelineTrace(odrive_tracer *tracer, int index, int ack)
+{
+    pipeline_window& window = window_;
+    libusb_transfer *out = out_transfers_[index];
+    uint16_t endpoint_id = window.packets[index][2] | (window.packets[index][3] << 8);
+
+    if (out->status == LIBUSB_TRANSFER_COMPLETED) {
+        trace(tracer, ODRIVE_TRACE_OUT_DONE, window.seq_nos[index], endpoint_id,
+                out->actual_length, 0, window.sent_ns[index]);
+    } else {
+        trace(tracer, ODRIVE_TRACE_ERROR, window.seq_nos[index], endpoint_id,
+                0, LIBUSB_ERROR_IO, window.sent_ns[index]);
+    }
+    if (!window.requests[index].ack) {
+        return;
+    }
+
+    libusb_transfer *in = in_transfers_[ack];
+    if (in->status == LIBUSB_TRANSFER_COMPLETED) {
+        trace(tracer, ODRIVE_TRACE_IN, window.seq_nos[index], endpoint_id,
+                in->actual_length, 0, window.received_ns[ack]);
+    } else {
+        trace(tracer, ODRIVE_TRACE_ERROR, window.seq_nos[index], endpoint_id,
+                0, in->status == LIBUSB_TRANSFER_TIMED_OUT ? LIBUSB_ERROR_TIMEOUT : LIBUSB_ERROR_IO,
+                window.received_ns[ack]);
+    }
+}
+
+/**
+ *
+ * Store the results of the completed window in its requests
+ * Responses arrive in request order, they are matched back by sequence number
+ * Must be called with ep_lock held
+ * @return LIBUSB_SUCCESS when every request succeeded
+ *
+ */
+int dhr::odrive::pipelineFinish(void)
+{
+    pipeline_window& window = window_;
+    odrive_tracer *tracer = pinTracer();
+    int ack = 0;
+
+    for (int i = 0; i < window.count; i++) {
+        odrive_request& request = window.requests[i];
+        if (i >= window.sent) {
+            request.status = window.status;
+            continue;
+        }
+        if (tracer) {
+            pipelineTrace(tracer, i, ack);
+        }
+        if (out_transfers_[i]->status != LIBUSB_TRANSFER_COMPLETED) {
+            ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in transfering data to USB!");
+            request.status = LIBUSB_ERROR_IO;
+        } else if (out_transfers_[i]->actual_length != (int)window.packets[i].size()) {
+            ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error in transfering data to USB, not all data transferred!");
+        }
+        if (!request.ack) {
+            continue;
+        }
+        libusb_transfer *transfer = in_transfers_[ack++];
+        if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+            ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error in reading data from USB!");
+            request.status = (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) ?
+                    LIBUSB_ERROR_TIMEOUT : LIBUSB_ERROR_IO;
+            continue;
+        }
+        commBuffer receive_buffer(transfer->buffer, transfer->buffer + transfer->actual_length);
+        short received_seq_no = 0;
+        request.received_payload = decodeODrivePacket(receive_buffer, received_seq_no, receive_buffer);
+        if (received_seq_no != window.seq_nos[i]) {
+            ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error Received data out of order");
+            request.status = LIBUSB_ERROR_IO;
+        }
+    }
+    unpinTracer(tracer);
+
+    for (int i = 0; i < window.count; i++) {
+        if (window.requests[i].status != LIBUSB_SUCCESS) {
+            return window.requests[i].status;
+        }
+    }
+    return window.status;
+}
+
+/**
+ *
+ * Send a window of requests with all packets in flight at once
+ * Must be called with ep_lock held
+ * @param requests first request of the window
+ * @param count number of requests, at most ODRIVE_PIPELINE_DEPTH
+ * @return LIBUSB_SUCCESS when every request succeeded
+ *
+ */
+int dhr::odrive::pipelineRequests(odrive_request *requests, int count)
+{
+    if (pipelinePrepare(requests, count) == LIBUSB_SUCCESS) {
+        pipelineStart();
+    }
+
+    struct timeval tv = { 0, 100000 };
+    while (pipelinePoll(&tv)) {
+    }
+
+    return pipelineFinish();
+}
+
+/**
+ *
+ * Request a batch of endpoints
+ * Requests are pipelined ODRIVE_PIPELINE_DEPTH at a time under a single
+ * hold of ep_lock, results are stored in each request. Bulk priority
+ * batches release ep_lock between windows so higher classes can go first,
+ * so packets of other threads may land between their windows unless the
+ * batch is atomic.
+ * @param requests requests to send, updated with received data and status
+ * @param atomic hold ep_lock for the whole batch even at bulk priority
+ * @return LIBUSB_SUCCESS when every request succeeded
+ *
+ */
+int dhr::odrive::endpointRequestBatch(std::vector<odrive_request>& requests, bool atomic)
+{
+    int status = LIBUSB_SUCCESS;
+    bool bulk = !atomic && getRequestPriority() == ODRIVE_PRIORITY_BULK;
+
+    if (requests.empty()) {
+        return LIBUSB_SUCCESS;
+    }
+    if (!bulk) {
+        ep_lock.lock(requests.size());
+    }
+
+    for (size_t first = 0; first < requests.size(); first += ODRIVE_PIPELINE_DEPTH) {
+        int count = std::min<size_t>(requests.size() - first, ODRIVE_PIPELINE_DEPTH);
+        if (bulk) {
+            ep_lock.lock(count);
+        }
+        int result = pipelineRequests(&requests[first], count);
+        if (bulk) {
+            ep_lock.unlock();
+        }
+        if (result != LIBUSB_SUCCESS) {
+            status = result;
+        }
+    }
+
+    if (!bulk) {
+        ep_lock.unlock();
+    }
+
+    return status;
+}
+
+/**
+ *
+ * Collect the USB event fds of several targets
+ * Without fds (no poll support) pipelineWait sleeps 1 ms between polls
+ * @param targets locked targets
+ * @param fds event fds of every target context
+ *
+ */
+void dhr::odrive::getPollFds(const std::vector<odrive *>& targets, std::vector<struct pollfd>& fds)
+{
+    fds.clear();
+    for (odrive *od : targets) {
+        const struct libusb_pollfd **usb_fds = libusb_get_pollfds(od->libusb_context_);
+        if (usb_fds == NULL) {
+            fds.clear();
+            return;
+        }
+        for (int i = 0; usb_fds[i] != NULL; i++) {
+            struct pollfd fd = { usb_fds[i]->fd, usb_fds[i]->events, 0 };
+            fds.push_back(fd);
+        }
+        libusb_free_pollfds(usb_fds);
+    }
+}
+
+/**
+ *
+ * Block until a target has USB events or a transfer timeout is due
+ * Must be called with the ep_lock of every target held
+ * @param targets locked targets
+ * @param fds event fds from getPollFds
+ *
+ */
+void dhr::odrive::pipelineWait(const std::vector<odrive *>& targets, std::vector<struct pollfd>& fds)
+{
+    int timeout_ms = fds.empty() ? 1 : 100;
+    for (odrive *od : targets) {
+        struct timeval next;
+        if (od->window_.pending > 0 && libusb_get_next_timeout(od->libusb_context_, &next) == 1) {
+            timeout_ms = std::min<int>(timeout_ms, next.tv_sec * 1000 + (next.tv_usec + 999) / 1000);
+        }
+    }
+
+    if (fds.empty()) {
+        usleep(timeout_ms * 1000);
+        return;
+    }
+    poll(fds.data(), fds.size(), timeout_ms);
+}
+
+/**
+ *
+ * Write to several targets at once
+ * Every target is locked and every packet encoded before the first
+ * transfer starts, then the OUT transfers of all targets are submitted
+ * back to back so the commands reach the targets with minimal skew.
+ * The reported skew is the spread of the OUT completion times as seen
+ * by the host; it includes event handling delay and is not a timestamp
+ * taken on the targets.
+ * @param commands commands, at most ODRIVE_PIPELINE_DEPTH per target, updated with status
+ * @param stats achieved skew and duration, may be NULL
+ * @return LIBUSB_SUCCESS when every command succeeded
+ *
+ */
+int dhr::odrive::requestSynchronized(std::vector<odrive_command>& commands,
+                odrive_sync_stats *stats)
+{
+    std::vector<odrive *> targets;
+    std::vector<std::vector<odrive_request> > requests;
+    std::vector<std::pair<size_t, size_t> > index;
+    int status = LIBUSB_SUCCESS;
+
+    // Group commands by target, keeping their order
+    for (const odrive_command& command : commands) {
+        size_t t = std::find(targets.begin(), targets.end(), command.endpoint) - targets.begin();
+        if (t == targets.size()) {
+            targets.push_back(command.endpoint);
+            requests.resize(t + 1);
+        }
+        if (requests[t].size() == ODRIVE_PIPELINE_DEPTH) {
+            ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error too many commands for one target");
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+        index.push_back(std::make_pair(t, requests[t].size()));
+        requests[t].push_back(makeWriteRequest(command.endpoint_id, command.value));
+    }
+
+    // Lock in address order so concurrent callers can not deadlock
+    std::vector<odrive *> lock_order = targets;
+    std::sort(lock_order.begin(), lock_order.end());
+    for (odrive *od : lock_order) {
+        size_t t = std::find(targets.begin(), targets.end(), od) - targets.begin();
+        od->ep_lock.lock(requests[t].size());
+    }
+
+    int64_t start = getMonotonicTime();
+    std::vector<bool> prepared(targets.size());
+    for (size_t t = 0; t < targets.size(); t++) {
+        prepared[t] = targets[t]->pipelinePrepare(&requests[t][0], requests[t].size()) == LIBUSB_SUCCESS;
+    }
+    for (size_t t = 0; t < targets.size(); t++) {
+        if (prepared[t]) {
+            targets[t]->pipelineStart();
+        }
+    }
+
+    // Targets have their own USB context: wait on the event fds of all of
+    // them, then handle each without blocking
+    std::vector<struct pollfd> fds;
+    if (targets.size() > 1) {
+        getPollFds(targets, fds);
+    }
+    struct timeval tv = { 0, targets.size() == 1 ? 100000 : 0 };
+    bool pending = true;
+    while (pending) {
+        if (targets.size() > 1) {
+            pipelineWait(targets, fds);
+        }
+        pending = false;
+        for (odrive *od : targets) {
+            pending |= od->pipelinePoll(&tv);
+        }
+    }
+
+    int64_t first_sent = INT64_MAX;
+    int64_t last_sent = 0;
+    for (odrive *od : targets) {
+        int result = od->pipelineFinish();
+        if (result != LIBUSB_SUCCESS) {
+            status = result;
+        }
+        for (int i = 0; i < od->window_.sent; i++) {
+            if (od->window_.sent_ns[i]) {
+                first_sent = std::min(first_sent, od->window_.sent_ns[i]);
+                last_sent = std::max(last_sent, od->window_.sent_ns[i]);
+            }
+        }
+    }
+    int64_t end = getMonotonicTime();
+
+    for (odrive *od : lock_order) {
+        od->ep_lock.unlock();
+    }
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        commands[i].status = requests[index[i].first][index[i].second].status;
+    }
+    if (stats) {
+        stats->skew_ns = (last_sent >= first_sent) ? last_sent - first_sent : 0;
+        stats->duration_ns = end - start;
+    }
+
+    return status;
+}
+
+/**
+ *
+ * Record every packet to a tracer
+ * Once this returns the previous tracer gets no more records
+ * @param tracer tracer used by this odrive only, NULL to stop tracing
+ *
+ */
+void dhr::odrive::setTracer(odrive_tracer *tracer)
+{
+    tracer_.store(tracer);
+    // Requests pin the tracer for one window at most, wait for those still
+    // holding the previous one
+    while (tracer_users_.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ *
+ * Pin the tracer for a run of records, pair with unpinTracer
+ * setTracer waits for pinned tracers, so records need no lock
+ * @return tracer, NULL when not tracing
+ *
+ */
+dhr::odrive_tracer *dhr::odrive::pinTracer(void)
+{
+    if (tracer_.load(std::memory_order_relaxed) == NULL) {
+        return NULL;
+    }
+    // Count before the load: setTracer stores before it reads the count,
+    // so either it sees this user or this load sees its tracer
+    tracer_users_.fetch_add(1);
+    odrive_tracer *tracer = tracer_.load();
+    if (tracer == NULL) {
+        tracer_users_.fetch_sub(1, std::memory_order_release);
+    }
+    return tracer;
+}
+
+/**
+ *
+ * Release a tracer returned by pinTracer
+ * @param tracer pinned tracer, NULL does nothing
+ *
+ */
+void dhr::odrive::unpinTracer(odrive_tracer *tracer)
+{
+    if (tracer) {
+        tracer_users_.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+/**
+ *
+ * Record packet event to a pinned tracer
+ * Must be called with ep_lock held, which keeps the tracer single producer
+ * @param tracer tracer from pinTracer, NULL when not tracing
+ * @param type ODRIVE_TRACE_* type
+ * @param seq_no packet sequence number
+ * @param endpoint_id odrive ID
+ * @param length packet size
+ * @param status libusb error of ODRIVE_TRACE_ERROR
+ * @param timestamp_ns monotonic time of the event, 0 for now
+ *
+ */
+void dhr::odrive::trace(odrive_tracer *tracer, uint8_t type, uint16_t seq_no, uint16_t endpoint_id,
+                uint16_t length, int status, int64_t timestamp_ns)
+{
+    if (tracer) {
+        tracer->record(type, seq_no, endpoint_id, length,
+                timestamp_ns ? timestamp_ns : getMonotonicTime(), status);
+    }
+}
+
+/**
+ *
+ * Cap bulk priority requests
+ * @param requests_per_second average bulk rate, 0 for no cap
+ *
+ */
+void dhr::odrive::setBulkRate(int requests_per_second)
+{
+    ep_lock.setBulkRate(requests_per_second);
+}
+
+/**
+ *
+ * Wait for the endpoint per priority class
+ * @param priority ODRIVE_PRIORITY_* class
+ * @return requests and their wait for the endpoint
+ *
+ */
+dhr::odrive_dispatch_stats dhr::odrive::getDispatchStats(int priority)
+{
+    return ep_lock.getStats(priority);
+}
 
-    }
+/**
+ *
+ * Set json CRC sent with every request
+ * @param crc CRC16 of the target json
+ *
+ */
+void dhr::odrive::setJsonCrc(uint16_t crc)
+{
+    json_crc_.store(crc, std::memory_order_relaxed);
+}
 
-    // Get responce
-    if (ack) {
-        result = libusb_bulk_transfer(odrive_handle_, ODRIVE_IN_EP,
-    		receive_bytes, ODRIVE_MAX_BYTES_TO_RECEIVE,
-    		&received_bytes, ODRIVE_TIMEOUT);
-        if (result != LIBUSB_SUCCESS) {
-		    std::cout << "* Error in reading data from USB!" <<  std::endl;
-            ep_lock.unlock();
-            return result;
-        }
+/**
+ *
+ * Get json CRC sent with every request
+ * @return CRC16 of the target json
+ *
+ */
+uint16_t dhr::odrive::getJsonCrc(void)
+{
+    return json_crc_.load(std::memory_order_relaxed);
+}
 
-        // Push recevived data to buffer
-        for (int i = 0; i < received_bytes; i++) {
-            receive_buffer.push_back(receive_bytes[i]);
-        }
+/**
+ *
+ * Check the target accepts a json CRC
+ * Targets silently drop requests with a wrong CRC, so a read that
+ * times out means the CRC belongs to another firmware. The CRC is kept
+ * on success and the previous one restored otherwise.
+ * @param crc CRC16 to try
+ * @param endpoint_id readable odrive ID
+ * @param length value size of endpoint_id
+ * @return LIBUSB_SUCCESS if the target answered
+ *
+ */
+int dhr::odrive::probeJsonCrc(uint16_t crc, int endpoint_id, int length)
+{
+    commBuffer tx;
+    commBuffer rx;
+    int rx_length = 0;
 
-        received_payload = decodeODrivePacket(receive_buffer, received_seq_no, receive_buffer);
-        if (received_seq_no != seq_no) {
-				std::cout << "* Error Received data out of order" << std::endl;
-        }
-        received_length = received_payload.size();
+    uint16_t previous = getJsonCrc();
+    setJsonCrc(crc);
 
+    int result = endpointRequest(endpoint_id, rx, rx_length, tx, true, length,
+                    false, 0, ODRIVE_CRC_PROBE_TIMEOUT);
+    if (result != LIBUSB_SUCCESS || rx_length != length) {
+        setJsonCrc(previous);
+        return result != LIBUSB_SUCCESS ? result : LIBUSB_ERROR_IO;
     }
-
-    ep_lock.unlock();
-
     return LIBUSB_SUCCESS;
 }
 
-
-
 /*
  * Endpoint initialization function
  * @param Odrive Serial number
@@ -278,7 +1102,7 @@ int dhr::odrive::init(uint64_t serialNumber)
     int ret = 1;
     
     ssize_t device_count = libusb_get_device_list(libusb_context_, &usb_device_list);
-    std::cout << device_count << std::endl;
+    ODRIVE_LOG_VALUE(ODRIVE_LOG_DEBUG, "USB devices:", device_count);
     if (device_count <= 0) {
         return device_count;
     }
@@ -289,7 +1113,7 @@ int dhr::odrive::init(uint64_t serialNumber)
 
         int result = libusb_get_device_descriptor(device, &desc);
         if (result != LIBUSB_SUCCESS) {
-				std:: cout << "* Error getting device descriptor" << std::endl;
+				ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error getting device descriptor");
             continue;
         }
         /* Check USB devicei ID */
@@ -297,7 +1121,7 @@ int dhr::odrive::init(uint64_t serialNumber)
 
             libusb_device_handle *device_handle;
             if (libusb_open(device, &device_handle) != LIBUSB_SUCCESS) {
-                std ::cout << "* Error opeening USB device" << std::endl;
+                ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error opeening USB device");
                 continue;
              }
 
@@ -307,13 +1131,13 @@ int dhr::odrive::init(uint64_t serialNumber)
 
             if ((libusb_kernel_driver_active(device_handle, ifNumber) != LIBUSB_SUCCESS) &&
                     (libusb_detach_kernel_driver(device_handle, ifNumber) != LIBUSB_SUCCESS)) {
-					std:: cout << "* Driver error" << std::endl;
+					ODRIVE_LOG(ODRIVE_LOG_WARNING, "Driver error");
                 libusb_close(device_handle);
                 continue;
             }
 
             if ((result = libusb_claim_interface(device_handle, ifNumber)) !=  LIBUSB_SUCCESS) {
-					std::cout << "* Error claiming device" << std::endl;
+					ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error claiming device");
                 libusb_close(device_handle);
                 continue;
             } else {
@@ -322,7 +1146,7 @@ int dhr::odrive::init(uint64_t serialNumber)
 
  		result = libusb_get_string_descriptor_ascii(device_handle, desc.iSerialNumber, buf, 127);
                 if (result <= 0) {
-						std::cout << "* Error getting data" << std::endl;
+						ODRIVE_LOG(ODRIVE_LOG_WARNING, "Error getting data");
                     result = libusb_release_interface(device_handle, ifNumber);
                     libusb_close(device_handle);
                     continue;
@@ -332,7 +1156,7 @@ int dhr::odrive::init(uint64_t serialNumber)
                     std::string sn(stream.str());
 
                     if (sn.compare(0, strlen((const char*)buf), (const char*)buf) == 0) {
-							std:: cout << "Device " << serialNumber << " found" << std::endl;
+							ODRIVE_LOG_TEXT(ODRIVE_LOG_INFO, "Device found:", sn.c_str());
                         odrive_handle_ = device_handle;
                         attached_to_handle = true;
                         ret = ODRIVE_OK;
@@ -414,42 +1238,228 @@ int dhr::getObjectByName(Json::Value odrive_json, std::string name, dhr::odrive_
     }
 
     if (ret) {
-        std::cout << name.c_str() << " not found!\n";
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Not found:", name.c_str());
     }
     return ret;
 }
 
+/**
+ *
+ *  Monotonic clock
+ *  @return time in nanoseconds
+ *
+ */
+int64_t dhr::getMonotonicTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ *
+ *  Table for calcCrc16, one entry per leading byte
+ *
+ */
+struct crc16_table {
+    uint16_t entry[256];
+
+    crc16_table() {
+        for (int byte = 0; byte < 256; byte++) {
+            uint16_t remainder = byte << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                remainder = (remainder & 0x8000) ?
+                    (remainder << 1) ^ ODRIVE_CRC16_POLYNOMIAL : (remainder << 1);
+            }
+            entry[byte] = remainder;
+        }
+    }
+};
+
+/**
+ *
+ *  Compute CRC16 the way the target checks requests
+ *  @param remainder initial value, ODRIVE_PROTOCOL_VERSION for the json CRC
+ *  @param data data buffer
+ *  @param length data length
+ *  @return CRC16
+ *
+ */
+uint16_t dhr::calcCrc16(uint16_t remainder, const uint8_t *data, size_t length)
+{
+    static const crc16_table table;
+
+    for (size_t i = 0; i < length; i++) {
+        remainder = (remainder << 8) ^ table.entry[(remainder >> 8) ^ data[i]];
+    }
+    return remainder;
+}
+
+/**
+ *
+ *  Size of a target value type
+ *  @param type type name from target json
+ *  @return size in bytes, 0 if the type can not be transferred as a value
+ *
+ */
+int dhr::getTypeSize(const std::string& type)
+{
+    if (!type.compare("bool") || !type.compare("uint8") || !type.compare("int8")) {
+        return 1;
+    }
+    if (!type.compare("uint16") || !type.compare("int16")) {
+        return 2;
+    }
+    if (!type.compare("float") || !type.compare("uint32") || !type.compare("int32")) {
+        return 4;
+    }
+    if (!type.compare("uint64") || !type.compare("int64")) {
+        return 8;
+    }
+    return 0;
+}
+
+/**
+ *
+ *  Build request reading a value
+ *  @param id odrive ID
+ *  @param length value size in bytes
+ *  @return request for endpointRequestBatch
+ *
+ */
+dhr::odrive_request dhr::makeReadRequest(int id, int length)
+{
+    odrive_request request;
+    request.endpoint_id = id;
+    request.length = length;
+    return request;
+}
+
+/**
+ *
+ *  Build request writing a value
+ *  @param id odrive ID
+ *  @param value encoded value
+ *  @return request for endpointRequestBatch
+ *
+ */
+dhr::odrive_request dhr::makeWriteRequest(int id, const commBuffer& value)
+{
+    odrive_request request;
+    request.endpoint_id = id;
+    request.payload = value;
+    return request;
+}
+
+// Parsed target json by json CRC, shared by targets running the same firmware
+static std::mutex json_cache_lock;
+static std::map<uint16_t, Json::Value> json_cache;
+
 /**
  *
  *  Read JSON file from target
  *  @param endpoint odrive enumarated endpoint
  *  @param odrive_json pointer to target json object
+ *  @param text json as sent by the target, the bytes its CRC covers, may be NULL
  *
  */
-int dhr::getJson(dhr::odrive *endpoint, Json::Value *odrive_json)
+int dhr::getJson(dhr::odrive *endpoint, Json::Value *odrive_json, std::string *text)
 {
+    odrive_priority_scope bulk(ODRIVE_PRIORITY_BULK);
 
     commBuffer rx;
     commBuffer tx;
-    int len;
+    int len = 0;
     int address = 0;
     std::string json;
 
     do {
-        endpoint->endpointRequest(0, rx, len, tx, true, 64, true, address);
+        if (endpoint->endpointRequest(0, rx, len, tx, true, 64, true, address) != LIBUSB_SUCCESS) {
+            ODRIVE_LOG_VALUE(ODRIVE_LOG_ERROR, "Error reading json at", address);
+            return 1;
+        }
         address = address + len;
-        json.append((const char *)&rx[0], (size_t)len);
+        json.append((const char *)rx.data(), (size_t)len);
     } while (len > 0);
 
-    Json::Reader reader;
-    bool res = reader.parse(json, *odrive_json);
-    if (!res) {
-        std::cout <<  "* Error parsing json!" << std::endl;
-        return 1;
+    // Only a complete, valid json may change the CRC the target checks
+    uint16_t crc = calcCrc16(ODRIVE_PROTOCOL_VERSION, (const uint8_t *)json.data(), json.size());
+    {
+        std::lock_guard<std::mutex> lock(json_cache_lock);
+        std::map<uint16_t, Json::Value>::const_iterator it = json_cache.find(crc);
+        if (it != json_cache.end()) {
+            *odrive_json = it->second;
+        } else {
+            Json::Reader reader;
+            if (!reader.parse(json, *odrive_json)) {
+                ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error parsing json!");
+                return 1;
+            }
+            json_cache[crc] = *odrive_json;
+        }
+    }
+
+    endpoint->setJsonCrc(crc);
+    if (text) {
+        text->swap(json);
     }
     return 0;
 }
 
+/**
+ *
+ *  Find a readable value to probe the json CRC with
+ *  @param odrive_json target json
+ *  @param odo found object
+ *  @return ODRIVE_OK on success
+ *
+ */
+static int getProbeObject(const Json::Value& odrive_json, dhr::odrive_object *odo)
+{
+    for (Json::Value::ArrayIndex i = 0; i < odrive_json.size(); i++) {
+        const Json::Value& js = odrive_json[i];
+        if (js["id"].asInt() > 0 && dhr::getTypeSize(js["type"].asString()) > 0) {
+            odo->name = js["name"].asString();
+            odo->id = js["id"].asInt();
+            odo->type = js["type"].asString();
+            odo->access = js["access"].asString();
+            return ODRIVE_OK;
+        }
+    }
+    return ODRIVE_FAILED;
+}
+
+/**
+ *
+ *  Get JSON of target, reusing a json already read from another target
+ *  Each cached json CRC is tried with a single short read before falling
+ *  back to reading the whole json
+ *  @param endpoint odrive enumarated endpoint
+ *  @param odrive_json pointer to target json object
+ *
+ */
+int dhr::getJsonCached(dhr::odrive *endpoint, Json::Value *odrive_json)
+{
+    std::map<uint16_t, Json::Value> cached;
+    {
+        std::lock_guard<std::mutex> lock(json_cache_lock);
+        cached = json_cache;
+    }
+
+    for (const std::pair<const uint16_t, Json::Value>& entry : cached) {
+        odrive_object odo;
+        if (getProbeObject(entry.second, &odo) != ODRIVE_OK) {
+            continue;
+        }
+        if (endpoint->probeJsonCrc(entry.first, odo.id, getTypeSize(odo.type)) == LIBUSB_SUCCESS) {
+            *odrive_json = entry.second;
+            return 0;
+        }
+    }
+
+    return getJson(endpoint, odrive_json);
+}
+
 /**
  *
  *  Read single value from target
@@ -508,7 +1518,8 @@ int dhr::writeOdriveData(dhr::odrive *endpoint, Json::Value odrive_json,
 
 /**
  *
- *  Exec target function
+ *  Exec target function without arguments
+ *  Outputs are read and discarded, see callOdriveFunctions
  *  @param endpoint odrive enumarated endpoint
  *  @param odrive_json target json
  *  @param object name
@@ -518,27 +1529,300 @@ int dhr::writeOdriveData(dhr::odrive *endpoint, Json::Value odrive_json,
 int dhr::execOdriveFunc(dhr::odrive *endpoint, Json::Value odrive_json,
                 std::string object)
 {
-    int ret;
-    odrive_object odo;
+    std::vector<odrive_call> calls(1);
 
-    ret = getObjectByName(odrive_json, object, &odo);
-    if (ret) {
-        std:: cout << "* Error getting ID" << std::endl;
-        return ret;
+    if (makeOdriveCall(odrive_json, object, &calls[0]) != ODRIVE_OK) {
+        return ODRIVE_FAILED;
     }
-
-    if (odo.type.compare("function")) {
-        std:: cout << "* Error invalid type" << std::endl;
-        return ret;
+    if (!calls[0].inputs.empty()) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Function needs arguments:", object.c_str());
+        return ODRIVE_FAILED;
     }
 
-    ret = endpoint->execFunc(odo.id);
+    int ret = callOdriveFunctions(endpoint, calls);
     if (ret != LIBUSB_SUCCESS) {
-        std::cout << "* Error executing "<< object.c_str() << " function" << std::endl;
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error executing function:", object.c_str());
+    }
+    return ret;
+}
+
+/**
+ *
+ *  Find json entry by full name
+ *  @param odrive_json target json
+ *  @param name entry name, e.g. axis0.controller.move_incremental
+ *  @return entry, NULL if not found
+ *
+ */
+static const Json::Value *findJsonEntry(const Json::Value& odrive_json, const std::string& name)
+{
+    const Json::Value *members = &odrive_json;
+    size_t begin = 0;
+
+    while (true) {
+        size_t end = name.find('.', begin);
+        std::string token = name.substr(begin, end - begin);
+        const Json::Value *entry = NULL;
+
+        for (Json::Value::ArrayIndex i = 0; i < members->size(); i++) {
+            if (!token.compare((*members)[i]["name"].asString())) {
+                entry = &(*members)[i];
+                break;
+            }
+        }
+        if (entry == NULL || end == std::string::npos) {
+            return entry;
+        }
+        members = &(*entry)["members"];
+        begin = end + 1;
+    }
+}
+
+/**
+ *
+ *  Collect argument or result endpoints of a function
+ *  @param members json inputs or outputs array
+ *  @param objects collected objects
+ *  @return ODRIVE_OK on success
+ *
+ */
+static int collectFunctionObjects(const Json::Value& members, std::vector<dhr::odrive_object>& objects)
+{
+    for (Json::Value::ArrayIndex i = 0; i < members.size(); i++) {
+        dhr::odrive_object odo;
+        odo.name = members[i]["name"].asString();
+        odo.id = members[i]["id"].asInt();
+        odo.type = members[i]["type"].asString();
+        odo.access = members[i]["access"].asString();
+
+        if (!dhr::getTypeSize(odo.type)) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Unsupported argument type:", odo.type.c_str());
+            return ODRIVE_FAILED;
+        }
+        objects.push_back(odo);
+    }
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Scan for function in target JSON
+ *  @param odrive_json target json
+ *  @param name function name
+ *  @param function function with its argument and result endpoints
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::getFunctionByName(const Json::Value& odrive_json, std::string name, dhr::odrive_function *function)
+{
+    const Json::Value *entry = findJsonEntry(odrive_json, name);
+
+    if (entry == NULL) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Not found:", name.c_str());
+        return ODRIVE_FAILED;
+    }
+    if ((*entry)["type"].asString().compare("function")) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Not a function:", name.c_str());
+        return ODRIVE_FAILED;
+    }
+
+    function->object.name = (*entry)["name"].asString();
+    function->object.id = (*entry)["id"].asInt();
+    function->object.type = (*entry)["type"].asString();
+    function->object.access = (*entry)["access"].asString();
+    function->inputs.clear();
+    function->outputs.clear();
+
+    if (collectFunctionObjects((*entry)["inputs"], function->inputs) != ODRIVE_OK ||
+            collectFunctionObjects((*entry)["outputs"], function->outputs) != ODRIVE_OK) {
+        return ODRIVE_FAILED;
+    }
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Build call for callOdriveFunctions
+ *  Arguments start zeroed; calls can be built once and only get their
+ *  arguments updated afterwards
+ *  @param odrive_json target json
+ *  @param name function name
+ *  @param call built call
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::makeOdriveCall(const Json::Value& odrive_json, std::string name, dhr::odrive_call *call)
+{
+    if (getFunctionByName(odrive_json, name, &call->function) != ODRIVE_OK) {
+        return ODRIVE_FAILED;
+    }
+
+    call->inputs.resize(call->function.inputs.size());
+    for (size_t i = 0; i < call->inputs.size(); i++) {
+        call->inputs[i].assign(getTypeSize(call->function.inputs[i].type), 0);
+    }
+    call->outputs.assign(call->function.outputs.size(), commBuffer());
+    call->status = LIBUSB_SUCCESS;
+
+    return ODRIVE_OK;
+}
+
+/*
+ *  Schema type names of the supported value types
+ */
+static const char *getTypeName(const uint8_t&) { return "uint8"; }
+static const char *getTypeName(const uint16_t&) { return "uint16"; }
+static const char *getTypeName(const uint32_t&) { return "uint32"; }
+static const char *getTypeName(const uint64_t&) { return "uint64"; }
+static const char *getTypeName(const short&) { return "int16"; }
+static const char *getTypeName(const int&) { return "int32"; }
+static const char *getTypeName(const float&) { return "float"; }
+static const char *getTypeName(const bool&) { return "bool"; }
+
+/**
+ *
+ *  Set call argument
+ *  @param call call built by makeOdriveCall
+ *  @param index argument index, in schema order
+ *  @param value argument, must match the argument type
+ *  @return ODRIVE_OK on success
+ *
+ */
+template<typename T>
+int dhr::setCallInput(dhr::odrive_call *call, size_t index, const T &value)
+{
+    if (index >= call->inputs.size() || call->function.inputs[index].type.compare(getTypeName(value))) {
+        ODRIVE_LOG_VALUE(ODRIVE_LOG_ERROR, "Invalid argument:", index);
+        return ODRIVE_FAILED;
+    }
+
+    memcpy(call->inputs[index].data(), &value, sizeof(value));
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Get call result
+ *  @param call call run by callOdriveFunctions
+ *  @param index result index, in schema order
+ *  @param value result, must match the result type
+ *  @return ODRIVE_OK on success
+ *
+ */
+template<typename T>
+int dhr::getCallOutput(const dhr::odrive_call& call, size_t index, T &value)
+{
+    if (call.status != LIBUSB_SUCCESS || index >= call.outputs.size() ||
+            call.function.outputs[index].type.compare(getTypeName(value)) ||
+            call.outputs[index].size() != sizeof(value)) {
+        return ODRIVE_FAILED;
+    }
+
+    memcpy(&value, call.outputs[index].data(), sizeof(value));
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Call target functions
+ *  Every call writes its arguments, triggers the function and reads its
+ *  results; all calls go out as one atomic pipelined batch, even at bulk
+ *  priority. The target handles packets in order and no other request can
+ *  land in between, so each function sees its own arguments.
+ *  @param endpoint odrive enumarated endpoint
+ *  @param calls calls built by makeOdriveCall, updated with results and status
+ *  @param duration_ns whole exchange duration, may be NULL
+ *  @return LIBUSB_SUCCESS when every call succeeded
+ *
+ */
+int dhr::callOdriveFunctions(dhr::odrive *endpoint, std::vector<dhr::odrive_call>& calls,
+                int64_t *duration_ns)
+{
+    std::vector<odrive_request> requests;
+    std::vector<size_t> first(calls.size() + 1);
+
+    for (size_t c = 0; c < calls.size(); c++) {
+        const odrive_function& function = calls[c].function;
+        first[c] = requests.size();
+
+        for (size_t i = 0; i < function.inputs.size(); i++) {
+            requests.push_back(makeWriteRequest(function.inputs[i].id, calls[c].inputs[i]));
+        }
+        requests.push_back(makeWriteRequest(function.object.id, commBuffer()));
+        for (size_t i = 0; i < function.outputs.size(); i++) {
+            requests.push_back(makeReadRequest(function.outputs[i].id,
+                    getTypeSize(function.outputs[i].type)));
+        }
+    }
+    first[calls.size()] = requests.size();
+
+    int64_t start = getMonotonicTime();
+    int ret = endpoint->endpointRequestBatch(requests, true);
+    if (duration_ns != NULL) {
+        *duration_ns = getMonotonicTime() - start;
+    }
+
+    for (size_t c = 0; c < calls.size(); c++) {
+        odrive_call& call = calls[c];
+        size_t outputs = first[c + 1] - call.function.outputs.size();
+
+        call.status = LIBUSB_SUCCESS;
+        for (size_t r = first[c]; r < first[c + 1]; r++) {
+            if (requests[r].status != LIBUSB_SUCCESS) {
+                call.status = requests[r].status;
+                break;
+            }
+        }
+        for (size_t i = 0; i < call.outputs.size(); i++) {
+            call.outputs[i] = requests[outputs + i].received_payload;
+        }
     }
     return ret;
 }
 
+/**
+ *
+ *  Build command for writeOdriveDataSync
+ *  Commands can be built once and only get their value updated afterwards
+ *  @param endpoint odrive enumarated endpoint
+ *  @param odrive_json target json
+ *  @param object name
+ *  @param value value to be written
+ *  @param command built command
+ *  @return ODRIVE_OK on success
+ *
+ */
+template<typename T>
+int dhr::makeOdriveCommand(dhr::odrive *endpoint, const Json::Value& odrive_json,
+                std::string object, const T &value, dhr::odrive_command *command)
+{
+    odrive_object odo;
+
+    if (getObjectByName(odrive_json, object, &odo) != ODRIVE_OK) {
+        return ODRIVE_FAILED;
+    }
+
+    command->endpoint = endpoint;
+    command->endpoint_id = odo.id;
+    command->value.assign((const uint8_t *)&value, (const uint8_t *)&value + sizeof(value));
+    command->status = LIBUSB_SUCCESS;
+
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Write values to one or several targets with minimal skew
+ *  @param commands commands built with makeOdriveCommand
+ *  @param stats achieved skew and duration, may be NULL
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::writeOdriveDataSync(std::vector<dhr::odrive_command>& commands,
+                dhr::odrive_sync_stats *stats)
+{
+    return odrive::requestSynchronized(commands, stats);
+}
 
 template int dhr::odrive::getData(int, bool&);
 template int dhr::odrive::getData(int, short&);
@@ -576,3 +1860,30 @@ template int dhr::readOdriveData(dhr::odrive*, Json::Value, std::string, int &);
 template int dhr::readOdriveData(dhr::odrive*, Json::Value, std::string, short &);
 template int dhr::readOdriveData(dhr::odrive*, Json::Value, std::string, float &);
 template int dhr::readOdriveData(dhr::odrive*, Json::Value, std::string, bool &); 
+
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const uint8_t &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const uint16_t &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const uint32_t &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const uint64_t &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const int &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const short &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const float &, dhr::odrive_command *);
+template int dhr::makeOdriveCommand(dhr::odrive *, const Json::Value&, std::string, const bool &, dhr::odrive_command *);
+
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const uint8_t &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const uint16_t &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const uint32_t &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const uint64_t &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const int &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const short &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const float &);
+template int dhr::setCallInput(dhr::odrive_call *, size_t, const bool &);
+
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, uint8_t &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, uint16_t &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, uint32_t &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, uint64_t &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, int &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, short &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, float &);
+template int dhr::getCallOutput(const dhr::odrive_call&, size_t, bool &);
@@ -0,0 +1,209 @@
+#include "odrive_aggregate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ *
+ * Finish statistics from reduced sums
+ * @param count number of samples
+ * @param sum sum of samples
+ * @param sum_squares sum of squared samples
+ * @param result mean and rms are stored here
+ *
+ */
+static void finishAggregate(int count, float sum, float sum_squares, dhr::odrive_aggregate *result)
+{
+    result->mean = sum / count;
+    result->rms = std::sqrt(sum_squares / count);
+}
+
+/**
+ *
+ * Windowed statistics of one channel, reference implementation
+ * @param samples samples of the window
+ * @param count number of samples, at least 1
+ * @param result statistics of the window
+ *
+ */
+void dhr::aggregateScalar(const float *samples, int count, dhr::odrive_aggregate *result)
+{
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    float sum = 0;
+    float sum_squares = 0;
+
+    for (int i = 0; i < count; i++) {
+        min = std::min(min, samples[i]);
+        max = std::max(max, samples[i]);
+        sum += samples[i];
+        sum_squares += samples[i] * samples[i];
+    }
+
+    result->min = min;
+    result->max = max;
+    result->last = samples[count - 1];
+    finishAggregate(count, sum, sum_squares, result);
+}
+
+/**
+ *
+ * Windowed statistics of one channel, 8 samples per iteration
+ * Two vector accumulators per statistic hide the add latency; the tail
+ * is handled by the scalar loop. Windows shorter than
+ * ODRIVE_AGGREGATE_VECTOR_MIN go to the scalar kernel.
+ * @param samples samples of the window
+ * @param count number of samples, at least 1
+ * @param result statistics of the window
+ *
+ */
+void dhr::aggregateVector(const float *samples, int count, dhr::odrive_aggregate *result)
+{
+    if (count < ODRIVE_AGGREGATE_VECTOR_MIN) {
+        aggregateScalar(samples, count, result);
+        return;
+    }
+
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    float sum = 0;
+    float sum_squares = 0;
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128 vmin0 = _mm_set1_ps(min), vmin1 = vmin0;
+    __m128 vmax0 = _mm_set1_ps(max), vmax1 = vmax0;
+    __m128 vsum0 = _mm_setzero_ps(), vsum1 = vsum0;
+    __m128 vsq0 = _mm_setzero_ps(), vsq1 = vsq0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128 x0 = _mm_loadu_ps(samples + i);
+        __m128 x1 = _mm_loadu_ps(samples + i + 4);
+        vmin0 = _mm_min_ps(vmin0, x0);
+        vmin1 = _mm_min_ps(vmin1, x1);
+        vmax0 = _mm_max_ps(vmax0, x0);
+        vmax1 = _mm_max_ps(vmax1, x1);
+        vsum0 = _mm_add_ps(vsum0, x0);
+        vsum1 = _mm_add_ps(vsum1, x1);
+        vsq0 = _mm_add_ps(vsq0, _mm_mul_ps(x0, x0));
+        vsq1 = _mm_add_ps(vsq1, _mm_mul_ps(x1, x1));
+    }
+
+    float lanes[4][4];
+    _mm_storeu_ps(lanes[0], _mm_min_ps(vmin0, vmin1));
+    _mm_storeu_ps(lanes[1], _mm_max_ps(vmax0, vmax1));
+    _mm_storeu_ps(lanes[2], _mm_add_ps(vsum0, vsum1));
+    _mm_storeu_ps(lanes[3], _mm_add_ps(vsq0, vsq1));
+    for (int lane = 0; lane < 4; lane++) {
+        min = std::min(min, lanes[0][lane]);
+        max = std::max(max, lanes[1][lane]);
+        sum += lanes[2][lane];
+        sum_squares += lanes[3][lane];
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t vmin0 = vdupq_n_f32(min), vmin1 = vmin0;
+    float32x4_t vmax0 = vdupq_n_f32(max), vmax1 = vmax0;
+    float32x4_t vsum0 = vdupq_n_f32(0), vsum1 = vsum0;
+    float32x4_t vsq0 = vdupq_n_f32(0), vsq1 = vsq0;
+
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t x0 = vld1q_f32(samples + i);
+        float32x4_t x1 = vld1q_f32(samples + i + 4);
+        vmin0 = vminq_f32(vmin0, x0);
+        vmin1 = vminq_f32(vmin1, x1);
+        vmax0 = vmaxq_f32(vmax0, x0);
+        vmax1 = vmaxq_f32(vmax1, x1);
+        vsum0 = vaddq_f32(vsum0, x0);
+        vsum1 = vaddq_f32(vsum1, x1);
+        vsq0 = vmlaq_f32(vsq0, x0, x0);
+        vsq1 = vmlaq_f32(vsq1, x1, x1);
+    }
+
+    float lanes[4][4];
+    vst1q_f32(lanes[0], vminq_f32(vmin0, vmin1));
+    vst1q_f32(lanes[1], vmaxq_f32(vmax0, vmax1));
+    vst1q_f32(lanes[2], vaddq_f32(vsum0, vsum1));
+    vst1q_f32(lanes[3], vaddq_f32(vsq0, vsq1));
+    for (int lane = 0; lane < 4; lane++) {
+        min = std::min(min, lanes[0][lane]);
+        max = std::max(max, lanes[1][lane]);
+        sum += lanes[2][lane];
+        sum_squares += lanes[3][lane];
+    }
+#endif
+
+    for (; i < count; i++) {
+        min = std::min(min, samples[i]);
+        max = std::max(max, samples[i]);
+        sum += samples[i];
+        sum_squares += samples[i] * samples[i];
+    }
+
+    result->min = min;
+    result->max = max;
+    result->last = samples[count - 1];
+    finishAggregate(count, sum, sum_squares, result);
+}
+
+/*
+ * Constructor
+ * @param channels number of values per frame
+ * @param window frames per result, the decimation factor
+ */
+
+dhr::odrive_aggregator::odrive_aggregator(int channels, int window)
+    : channels_(std::max(channels, 1)), window_(std::max(window, 1)),
+      samples_(channels_ * window_), result_(channels_)
+{
+}
+
+/**
+ *
+ * Add one frame
+ * @param frame one sample per channel
+ * @return true when a window completed and getResult was updated
+ *
+ */
+bool dhr::odrive_aggregator::push(const float *frame)
+{
+    for (int channel = 0; channel < channels_; channel++) {
+        samples_[channel * window_ + count_] = frame[channel];
+    }
+    if (++count_ < window_) {
+        return false;
+    }
+
+    for (int channel = 0; channel < channels_; channel++) {
+        aggregateVector(&samples_[channel * window_], window_, &result_[channel]);
+    }
+    count_ = 0;
+    return true;
+}
+
+/**
+ *
+ * Results of the last completed window
+ * @return one result per channel
+ *
+ */
+const std::vector<dhr::odrive_aggregate>& dhr::odrive_aggregator::getResult(void) const
+{
+    return result_;
+}
+
+int dhr::odrive_aggregator::getChannels(void) const
+{
+    return channels_;
+}
+
+int dhr::odrive_aggregator::getWindow(void) const
+{
+    return window_;
+}
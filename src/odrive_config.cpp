@@ -0,0 +1,412 @@
+#include "odrive_config.h"
+
+/**
+ *
+ *  Collect rw values of the config objects below a json object
+ *  Values outside config objects (requested_state, input_*, error) would
+ *  command the target rather than configure it, so they are skipped.
+ *  @param members json members array
+ *  @param prefix name prefix of the members
+ *  @param in_config members belong to a config object
+ *  @param objects collected objects
+ *
+ */
+static void collectConfigObjects(const Json::Value& members, const std::string& prefix,
+                bool in_config, std::vector<dhr::odrive_object>& objects)
+{
+    for (Json::Value::ArrayIndex i = 0; i < members.size(); i++) {
+        const Json::Value& member = members[i];
+        std::string name = prefix + member["name"].asString();
+        std::string type = member["type"].asString();
+
+        if (!type.compare("object")) {
+            collectConfigObjects(member["members"], name + ".",
+                    in_config || !member["name"].asString().compare("config"), objects);
+        } else if (in_config && !member["access"].asString().compare("rw") &&
+                dhr::getTypeSize(type) > 0) {
+            dhr::odrive_object odo;
+            odo.name = name;
+            odo.id = member["id"].asInt();
+            odo.type = type;
+            odo.access = member["access"].asString();
+            objects.push_back(odo);
+        }
+    }
+}
+
+/**
+ *
+ *  Scan target JSON for every rw config value
+ *  @param odrive_json target json
+ *  @param objects rw objects below config objects, named by their full path
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::getConfigObjects(const Json::Value& odrive_json, std::vector<odrive_object>& objects)
+{
+    objects.clear();
+    collectConfigObjects(odrive_json, "", false, objects);
+    return objects.empty() ? ODRIVE_FAILED : ODRIVE_OK;
+}
+
+/**
+ *
+ *  Read every rw config value of the target
+ *  @param endpoint odrive enumarated endpoint
+ *  @param odrive_json target json
+ *  @param snapshot values read
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::takeConfigSnapshot(dhr::odrive *endpoint, const Json::Value& odrive_json,
+                dhr::odrive_snapshot& snapshot)
+{
+    odrive_priority_scope bulk(ODRIVE_PRIORITY_BULK);
+    std::vector<odrive_object> objects;
+    std::vector<odrive_request> requests;
+
+    snapshot.clear();
+    if (getConfigObjects(odrive_json, objects) != ODRIVE_OK) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error no config values in json");
+        return ODRIVE_FAILED;
+    }
+
+    for (const odrive_object& odo : objects) {
+        requests.push_back(makeReadRequest(odo.id, getTypeSize(odo.type)));
+    }
+
+    int ret = endpoint->endpointRequestBatch(requests);
+
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (requests[i].status != LIBUSB_SUCCESS ||
+                (int)requests[i].received_payload.size() != getTypeSize(objects[i].type)) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error reading", objects[i].name.c_str());
+            ret = ODRIVE_FAILED;
+            continue;
+        }
+        odrive_config_entry entry;
+        entry.name = objects[i].name;
+        entry.id = objects[i].id;
+        entry.type = objects[i].type;
+        entry.value = requests[i].received_payload;
+        snapshot.push_back(entry);
+    }
+
+    return ret == LIBUSB_SUCCESS ? ODRIVE_OK : ODRIVE_FAILED;
+}
+
+/**
+ *
+ *  Compare snapshots by value name
+ *  @param current snapshot of the target
+ *  @param target wanted configuration
+ *  @param changes target values that differ, with the IDs of current
+ *  @return ODRIVE_OK on success, ODRIVE_FAILED if target has unknown values
+ *
+ */
+int dhr::diffConfigSnapshot(const dhr::odrive_snapshot& current,
+                const dhr::odrive_snapshot& target, dhr::odrive_snapshot& changes)
+{
+    int ret = ODRIVE_OK;
+    std::map<std::string, const odrive_config_entry *> by_name;
+
+    changes.clear();
+    for (const odrive_config_entry& entry : current) {
+        by_name[entry.name] = &entry;
+    }
+
+    for (const odrive_config_entry& entry : target) {
+        std::map<std::string, const odrive_config_entry *>::const_iterator it = by_name.find(entry.name);
+        if (it == by_name.end() || it->second->value.size() != entry.value.size()) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Not found:", entry.name.c_str());
+            ret = ODRIVE_FAILED;
+            continue;
+        }
+        if (it->second->value != entry.value) {
+            odrive_config_entry change = entry;
+            change.id = it->second->id;
+            changes.push_back(change);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ *
+ *  Write only the values of target that differ on the target
+ *  @param endpoint odrive enumarated endpoint
+ *  @param odrive_json target json
+ *  @param target wanted configuration
+ *  @param changed number of values written, may be NULL
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::applyConfigSnapshot(dhr::odrive *endpoint, const Json::Value& odrive_json,
+                const dhr::odrive_snapshot& target, int *changed)
+{
+    odrive_priority_scope bulk(ODRIVE_PRIORITY_BULK);
+    odrive_snapshot current;
+    odrive_snapshot changes;
+    std::vector<odrive_request> requests;
+
+    if (changed) {
+        *changed = 0;
+    }
+
+    int ret = takeConfigSnapshot(endpoint, odrive_json, current);
+    if (diffConfigSnapshot(current, target, changes) != ODRIVE_OK) {
+        ret = ODRIVE_FAILED;
+    }
+
+    for (const odrive_config_entry& entry : changes) {
+        requests.push_back(makeWriteRequest(entry.id, entry.value));
+    }
+    if (requests.empty()) {
+        return ret;
+    }
+
+    // One piece, so no other writer lands in the middle of the configuration
+    if (endpoint->endpointRequestBatch(requests, true) != LIBUSB_SUCCESS) {
+        ret = ODRIVE_FAILED;
+    }
+    if (changed) {
+        for (const odrive_request& request : requests) {
+            *changed += (request.status == LIBUSB_SUCCESS);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ *
+ *  Convert raw value to json
+ *  @param type type name from target json
+ *  @param value raw value
+ *  @return json value
+ *
+ */
+static Json::Value valueToJson(const std::string& type, const commBuffer& value)
+{
+    uint64_t raw = 0;
+    int size = dhr::getTypeSize(type);
+
+    memcpy(&raw, value.data(), std::min<size_t>(size, value.size()));
+
+    if (!type.compare("float")) {
+        float f;
+        memcpy(&f, &raw, sizeof(f));
+        return Json::Value((double)f);
+    }
+    if (!type.compare("bool")) {
+        return Json::Value(raw != 0);
+    }
+    if (type[0] == 'i' && size < 8) {
+        int shift = 64 - 8 * size;
+        return Json::Value((Json::Int64)((int64_t)(raw << shift) >> shift));
+    }
+    if (type[0] == 'i') {
+        return Json::Value((Json::Int64)raw);
+    }
+    return Json::Value((Json::UInt64)raw);
+}
+
+/**
+ *
+ *  Convert json to raw value
+ *  @param type type name from target json
+ *  @param json json value
+ *  @param value raw value
+ *  @return ODRIVE_OK on success
+ *
+ */
+static int valueFromJson(const std::string& type, const Json::Value& json, commBuffer& value)
+{
+    uint64_t raw = 0;
+    int size = dhr::getTypeSize(type);
+
+    if (!type.compare("float") && json.isNumeric()) {
+        float f = json.asFloat();
+        memcpy(&raw, &f, sizeof(f));
+    } else if (!type.compare("bool") && (json.isBool() || json.isIntegral())) {
+        raw = json.asBool();
+    } else if (type[0] == 'i' && json.isInt64()) {
+        raw = (uint64_t)json.asInt64();
+    } else if (type[0] == 'u' && json.isUInt64()) {
+        raw = json.asUInt64();
+    } else {
+        return ODRIVE_FAILED;
+    }
+
+    value.assign((uint8_t *)&raw, (uint8_t *)&raw + size);
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Convert snapshot to json
+ *  @param snapshot snapshot to convert
+ *  @param json json object mapping value names to values
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::snapshotToJson(const dhr::odrive_snapshot& snapshot, Json::Value *json)
+{
+    *json = Json::Value(Json::objectValue);
+    for (const odrive_config_entry& entry : snapshot) {
+        (*json)[entry.name] = valueToJson(entry.type, entry.value);
+    }
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Convert json to snapshot
+ *  @param odrive_json target json used to resolve names
+ *  @param json json object mapping value names to values
+ *  @param snapshot converted snapshot
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::snapshotFromJson(const Json::Value& odrive_json, const Json::Value& json,
+                dhr::odrive_snapshot& snapshot)
+{
+    int ret = ODRIVE_OK;
+    std::vector<odrive_object> objects;
+
+    snapshot.clear();
+    if (!json.isObject()) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error snapshot is not a json object");
+        return ODRIVE_FAILED;
+    }
+    getConfigObjects(odrive_json, objects);
+
+    for (const odrive_object& odo : objects) {
+        if (!json.isMember(odo.name)) {
+            continue;
+        }
+        odrive_config_entry entry;
+        entry.name = odo.name;
+        entry.id = odo.id;
+        entry.type = odo.type;
+        if (valueFromJson(odo.type, json[odo.name], entry.value) != ODRIVE_OK) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error invalid value for", odo.name.c_str());
+            ret = ODRIVE_FAILED;
+            continue;
+        }
+        snapshot.push_back(entry);
+    }
+
+    if (snapshot.size() != json.size()) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error unknown values in snapshot");
+        ret = ODRIVE_FAILED;
+    }
+    return ret;
+}
+
+/**
+ *
+ *  Convert snapshot to compact binary
+ *  Layout: magic(4) version(2) crc(2) count(4), then per value id(2) size(1) data
+ *  @param snapshot snapshot to convert
+ *  @param json_crc CRC of the target json the IDs belong to
+ *  @param buf binary snapshot
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::snapshotToBinary(const dhr::odrive_snapshot& snapshot, uint16_t json_crc, commBuffer& buf)
+{
+    uint32_t magic = htole32(ODRIVE_SNAPSHOT_MAGIC);
+    uint16_t version = htole16(ODRIVE_SNAPSHOT_VERSION);
+    uint16_t crc = htole16(json_crc);
+    uint32_t count = htole32(snapshot.size());
+
+    buf.clear();
+    buf.insert(buf.end(), (uint8_t *)&magic, (uint8_t *)&magic + sizeof(magic));
+    buf.insert(buf.end(), (uint8_t *)&version, (uint8_t *)&version + sizeof(version));
+    buf.insert(buf.end(), (uint8_t *)&crc, (uint8_t *)&crc + sizeof(crc));
+    buf.insert(buf.end(), (uint8_t *)&count, (uint8_t *)&count + sizeof(count));
+
+    for (const odrive_config_entry& entry : snapshot) {
+        uint16_t id = htole16(entry.id);
+        buf.insert(buf.end(), (uint8_t *)&id, (uint8_t *)&id + sizeof(id));
+        buf.push_back(entry.value.size());
+        buf.insert(buf.end(), entry.value.begin(), entry.value.end());
+    }
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Convert compact binary to snapshot
+ *  @param odrive_json target json used to resolve IDs
+ *  @param json_crc CRC of odrive_json, must match the snapshot
+ *  @param buf binary snapshot
+ *  @param snapshot converted snapshot
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::snapshotFromBinary(const Json::Value& odrive_json, uint16_t json_crc,
+                const commBuffer& buf, dhr::odrive_snapshot& snapshot)
+{
+    uint32_t magic, count;
+    uint16_t version, crc;
+    std::vector<odrive_object> objects;
+    std::map<int, const odrive_object *> by_id;
+    size_t pos = 12;
+
+    snapshot.clear();
+    if (buf.size() < pos) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error snapshot too short");
+        return ODRIVE_FAILED;
+    }
+    memcpy(&magic, &buf[0], sizeof(magic));
+    memcpy(&version, &buf[4], sizeof(version));
+    memcpy(&crc, &buf[6], sizeof(crc));
+    memcpy(&count, &buf[8], sizeof(count));
+    if (le32toh(magic) != ODRIVE_SNAPSHOT_MAGIC || le16toh(version) != ODRIVE_SNAPSHOT_VERSION) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error invalid snapshot header");
+        return ODRIVE_FAILED;
+    }
+    if (le16toh(crc) != json_crc) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error snapshot taken with a different json");
+        return ODRIVE_FAILED;
+    }
+
+    getConfigObjects(odrive_json, objects);
+    for (const odrive_object& odo : objects) {
+        by_id[odo.id] = &odo;
+    }
+
+    for (uint32_t i = 0; i < le32toh(count); i++) {
+        uint16_t id;
+        if (pos + 3 > buf.size()) {
+            break;
+        }
+        memcpy(&id, &buf[pos], sizeof(id));
+        size_t size = buf[pos + 2];
+        pos += 3;
+
+        std::map<int, const odrive_object *>::const_iterator it = by_id.find(le16toh(id));
+        if (pos + size > buf.size() || it == by_id.end() ||
+                getTypeSize(it->second->type) != (int)size) {
+            ODRIVE_LOG_VALUE(ODRIVE_LOG_ERROR, "Error invalid snapshot value", le16toh(id));
+            return ODRIVE_FAILED;
+        }
+
+        odrive_config_entry entry;
+        entry.name = it->second->name;
+        entry.id = it->second->id;
+        entry.type = it->second->type;
+        entry.value.assign(buf.begin() + pos, buf.begin() + pos + size);
+        snapshot.push_back(entry);
+        pos += size;
+    }
+
+    if (snapshot.size() != le32toh(count)) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error snapshot truncated");
+        return ODRIVE_FAILED;
+    }
+    return ODRIVE_OK;
+}
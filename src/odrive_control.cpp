@@ -0,0 +1,400 @@
+#include "odrive_control.h"
+
+#include <cmath>
+#include <time.h>
+
+/**
+ *
+ * Clamp value to a symmetric limit
+ * @param value value to clamp
+ * @param limit positive limit
+ * @return clamped value
+ *
+ */
+static float clampSymmetric(float value, float limit)
+{
+    return std::max(-limit, std::min(limit, value));
+}
+
+/*
+ * Constructor
+ * @param pos_gain position error to velocity [(turns/s)/turn]
+ * @param vel_gain velocity error to torque [Nm/(turns/s)]
+ * @param vel_integrator_gain integrated velocity error to torque [Nm/turn]
+ * @param vel_limit velocity command limit [turns/s]
+ * @param torque_limit torque command limit [Nm]
+ */
+
+dhr::odrive_pid_controller::odrive_pid_controller(float pos_gain, float vel_gain,
+        float vel_integrator_gain, float vel_limit, float torque_limit)
+    : pos_gain_(pos_gain), vel_gain_(vel_gain), vel_integrator_gain_(vel_integrator_gain),
+      vel_limit_(vel_limit), torque_limit_(torque_limit){
+}
+
+/**
+ *
+ * Torque command of the cascaded loop
+ * The integrator only runs while the torque is not limited
+ * @param state estimated state and setpoints
+ * @param dt tick period [s]
+ * @return torque command [Nm]
+ *
+ */
+float dhr::odrive_pid_controller::update(const dhr::odrive_axis_state& state, float dt)
+{
+    float vel_des = state.vel_setpoint + pos_gain_ * (state.pos_setpoint - state.pos);
+    vel_des = clampSymmetric(vel_des, vel_limit_);
+
+    float v_err = vel_des - state.vel;
+    float torque = state.torque_feedforward + vel_gain_ * v_err + vel_integrator_;
+
+    if (std::fabs(torque) > torque_limit_) {
+        torque = clampSymmetric(torque, torque_limit_);
+    } else {
+        vel_integrator_ += vel_integrator_gain_ * dt * v_err;
+    }
+    return torque;
+}
+
+void dhr::odrive_pid_controller::reset(void)
+{
+    vel_integrator_ = 0;
+}
+
+/*
+ * Constructor
+ * @param k_pos position error to torque [Nm/turn]
+ * @param k_vel velocity error to torque [Nm/(turns/s)]
+ * @param torque_limit torque command limit [Nm]
+ */
+
+dhr::odrive_state_feedback_controller::odrive_state_feedback_controller(float k_pos,
+        float k_vel, float torque_limit)
+    : k_pos_(k_pos), k_vel_(k_vel), torque_limit_(torque_limit){
+}
+
+/**
+ *
+ * Torque command of the state feedback law
+ * Memoryless, so the tick period is not used
+ * @param state estimated state and setpoints
+ * @return torque command [Nm]
+ *
+ */
+float dhr::odrive_state_feedback_controller::update(const dhr::odrive_axis_state& state, float /* dt */)
+{
+    float torque = state.torque_feedforward + k_pos_ * (state.pos_setpoint - state.pos) +
+            k_vel_ * (state.vel_setpoint - state.vel);
+    return clampSymmetric(torque, torque_limit_);
+}
+
+/*
+ * Constructor
+ * @param bandwidth PLL bandwidth [rad/s], gains as in the target encoder estimator
+ */
+
+dhr::odrive_axis_estimator::odrive_axis_estimator(float bandwidth)
+    : kp_(2.0f * bandwidth), ki_(0.25f * kp_ * kp_){
+}
+
+/**
+ *
+ * Track one encoder reading
+ * @param pos_measured encoder position [turns]
+ * @param dt time since the previous reading [s]
+ * @param pos estimated position [turns]
+ * @param vel estimated velocity [turns/s]
+ *
+ */
+void dhr::odrive_axis_estimator::update(float pos_measured, float dt, float *pos, float *vel)
+{
+    if (!initialized_) {
+        reset(pos_measured);
+    }
+
+    pos_ += dt * vel_;
+    float delta = pos_measured - pos_;
+    pos_ += std::min(dt * kp_, 1.0f) * delta;
+    vel_ += dt * ki_ * delta;
+
+    *pos = pos_;
+    *vel = vel_;
+}
+
+void dhr::odrive_axis_estimator::reset(float pos)
+{
+    pos_ = pos;
+    vel_ = 0;
+    initialized_ = true;
+}
+
+void dhr::odrive_axis_estimator::reset(void)
+{
+    initialized_ = false;
+}
+
+/*
+ * Constructor
+ *
+ */
+
+dhr::odrive_control_engine::odrive_control_engine() : running_(false){
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_control_engine::~odrive_control_engine(){
+		stop();
+}
+
+/**
+ *
+ * Add axis closed on the host
+ * The axis must already run closed loop in torque control mode
+ * @param endpoint odrive enumarated endpoint
+ * @param odrive_json target json
+ * @param axis axis name, e.g. axis0
+ * @param controller controller of the axis, owned by the caller
+ * @param estimator_bandwidth PLL bandwidth [rad/s]
+ * @return axis index, -1 on error
+ *
+ */
+int dhr::odrive_control_engine::addAxis(dhr::odrive *endpoint, const Json::Value& odrive_json,
+                const std::string& axis, dhr::odrive_axis_controller *controller,
+                float estimator_bandwidth)
+{
+    odrive_object torque, pos;
+
+    if (running_.load()) {
+        return -1;
+    }
+    if (getObjectByName(odrive_json, axis + ".controller.input_torque", &torque) != ODRIVE_OK ||
+            getObjectByName(odrive_json, axis + ".encoder.pos_estimate", &pos) != ODRIVE_OK) {
+        return -1;
+    }
+
+    size_t target = std::find(targets_.begin(), targets_.end(), endpoint) - targets_.begin();
+    if (target == targets_.size()) {
+        targets_.push_back(endpoint);
+        exchanges_.resize(target + 1);
+    }
+
+    // Keep the writes ahead of the reads of the same target
+    std::vector<odrive_request>& exchange = exchanges_[target];
+    float zero = 0;
+    int writes = 0;
+    for (const control_axis& other : axes_) {
+        writes += (other.target == (int)target);
+    }
+    exchange.insert(exchange.begin() + writes,
+            makeWriteRequest(torque.id, commBuffer((uint8_t *)&zero, (uint8_t *)&zero + sizeof(zero))));
+    for (control_axis& other : axes_) {
+        if (other.target == (int)target) {
+            other.pos_request++;
+        }
+    }
+
+    control_axis entry = { (int)target, writes, 0, controller,
+            odrive_axis_estimator(estimator_bandwidth), odrive_axis_state() };
+    entry.pos_request = exchange.size();
+    exchange.push_back(makeReadRequest(pos.id, sizeof(float)));
+
+    axes_.push_back(entry);
+    return axes_.size() - 1;
+}
+
+/**
+ *
+ * Set axis setpoints
+ * @param axis axis index from addAxis
+ * @param pos position setpoint [turns]
+ * @param vel velocity setpoint [turns/s]
+ * @param torque_feedforward torque added to the controller output [Nm]
+ *
+ */
+void dhr::odrive_control_engine::setSetpoint(int axis, float pos, float vel, float torque_feedforward)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (axis < 0 || axis >= (int)axes_.size()) {
+        return;
+    }
+    axes_[axis].state.pos_setpoint = pos;
+    axes_[axis].state.vel_setpoint = vel;
+    axes_[axis].state.torque_feedforward = torque_feedforward;
+}
+
+/**
+ *
+ * Run one tick
+ * @param dt tick period [s]
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_control_engine::step(float dt)
+{
+    return tick(dt, 0, false);
+}
+
+/**
+ *
+ * Exchange with every target, then run estimators and controllers
+ * @param dt tick period [s]
+ * @param jitter_ns tick start against schedule
+ * @param overrun tick started a whole period late
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_control_engine::tick(float dt, int64_t jitter_ns, bool overrun)
+{
+    odrive_priority_scope realtime(ODRIVE_PRIORITY_REALTIME);
+    int64_t start = getMonotonicTime();
+    bool failed = false;
+
+    for (size_t t = 0; t < targets_.size(); t++) {
+        failed |= targets_[t]->endpointRequestBatch(exchanges_[t]) != LIBUSB_SUCCESS;
+    }
+    int64_t latency = getMonotonicTime() - start;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    for (control_axis& axis : axes_) {
+        std::vector<odrive_request>& exchange = exchanges_[axis.target];
+        odrive_request& pos = exchange[axis.pos_request];
+
+        // Never resend a torque computed from stale feedback: command zero
+        // and start the loop over from the next reading
+        if (pos.status != LIBUSB_SUCCESS || pos.received_payload.size() != sizeof(float)) {
+            axis.state.torque = 0;
+            axis.controller->reset();
+            axis.estimator.reset();
+            memcpy(exchange[axis.torque_request].payload.data(), &axis.state.torque, sizeof(float));
+            stats_.feedback_lost++;
+            continue;
+        }
+        memcpy(&axis.state.pos_measured, pos.received_payload.data(), sizeof(float));
+
+        // The command lands one tick later, control the state expected by then
+        axis.estimator.update(axis.state.pos_measured, dt, &axis.state.pos, &axis.state.vel);
+        axis.state.pos += axis.state.vel * dt;
+
+        axis.state.torque = axis.controller->update(axis.state, dt);
+        memcpy(exchange[axis.torque_request].payload.data(), &axis.state.torque, sizeof(float));
+    }
+
+    stats_.ticks++;
+    stats_.overruns += overrun;
+    stats_.errors += failed;
+    stats_.latency_ns_last = latency;
+    stats_.latency_ns_max = std::max(stats_.latency_ns_max, latency);
+    stats_.latency_ns_mean += (latency - stats_.latency_ns_mean) / stats_.ticks;
+    stats_.jitter_ns_max = std::max(stats_.jitter_ns_max, jitter_ns);
+    jitter_sum_squares_ += (double)jitter_ns * jitter_ns;
+    stats_.jitter_ns_rms = std::sqrt(jitter_sum_squares_ / stats_.ticks);
+
+    return failed ? ODRIVE_FAILED : ODRIVE_OK;
+}
+
+/**
+ *
+ * Run ticks on a thread at a fixed rate
+ * @param rate_hz tick rate
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_control_engine::start(int rate_hz)
+{
+    if (rate_hz <= 0 || axes_.empty() || running_.exchange(true)) {
+        return ODRIVE_FAILED;
+    }
+    thread_ = std::thread(&odrive_control_engine::run, this, rate_hz);
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ * Tick loop, sleeps until each scheduled tick start
+ * A tick more than a period late is counted as overrun and the schedule
+ * restarts from it instead of bursting to catch up.
+ * @param rate_hz tick rate
+ *
+ */
+void dhr::odrive_control_engine::run(int rate_hz)
+{
+    int64_t period = 1000000000LL / rate_hz;
+    int64_t next = getMonotonicTime();
+    float dt = 1.0f / rate_hz;
+
+    while (running_.load()) {
+        int64_t jitter = getMonotonicTime() - next;
+        bool overrun = jitter > period;
+        if (overrun) {
+            next = getMonotonicTime();
+        }
+
+        tick(dt, std::abs(jitter), overrun);
+
+        next += period;
+        struct timespec ts = { (time_t)(next / 1000000000LL), (long)(next % 1000000000LL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+/**
+ *
+ * Stop thread and command zero torque on every axis
+ * Does nothing unless start ran, so an engine that was only configured or
+ * driven by step never touches its targets here
+ *
+ */
+void dhr::odrive_control_engine::stop(void)
+{
+    if (!running_.exchange(false)) {
+        return;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    odrive_priority_scope realtime(ODRIVE_PRIORITY_REALTIME);
+    float zero = 0;
+    for (size_t t = 0; t < targets_.size(); t++) {
+        std::vector<odrive_request> writes;
+        for (const control_axis& axis : axes_) {
+            if (axis.target == (int)t) {
+                writes.push_back(makeWriteRequest(exchanges_[t][axis.torque_request].endpoint_id,
+                        commBuffer((uint8_t *)&zero, (uint8_t *)&zero + sizeof(zero))));
+            }
+        }
+        targets_[t]->endpointRequestBatch(writes);
+    }
+}
+
+/**
+ *
+ * Latest state of an axis
+ * @param axis axis index from addAxis
+ * @return estimated state, setpoints and last torque command
+ *
+ */
+dhr::odrive_axis_state dhr::odrive_control_engine::getState(int axis)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (axis < 0 || axis >= (int)axes_.size()) {
+        return odrive_axis_state();
+    }
+    return axes_[axis].state;
+}
+
+/**
+ *
+ * Loop latency and jitter metrics
+ * @return copy of the metrics
+ *
+ */
+dhr::odrive_control_stats dhr::odrive_control_engine::getStats(void)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return stats_;
+}
@@ -0,0 +1,290 @@
+#include "odrive_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static const char *log_level_names[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+typedef struct _log_event {
+    int level;
+    const char *message;
+    char text[ODRIVE_LOG_TEXT_SIZE];
+    long long value;
+    bool has_value;
+    struct timespec timestamp;
+} log_event;
+
+/*
+ * Bounded multi producer queue with a single writer thread
+ * Each cell carries a sequence number telling producers and the writer
+ * whose turn it is, so neither side ever takes a lock. An idle writer
+ * sleeps on a futex; producers only make the wake syscall when it sleeps.
+ */
+class log_writer {
+public:
+    log_writer() : level_(ODRIVE_LOG_MIN_LEVEL), dropped_(0), running_(true),
+        enqueue_pos_(0), dequeue_pos_(0), written_(0), sleeping_(false), wake_seq_(0)
+    {
+        for (size_t i = 0; i < ODRIVE_LOG_QUEUE_SIZE; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        thread_ = std::thread(&log_writer::run, this);
+    }
+
+    /**
+     *
+     * Queue event, never blocks
+     * @param event event to queue
+     * @return false if the queue is full or the writer stopped
+     *
+     */
+    bool push(const log_event& event)
+    {
+        if (!running_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            log_cell& cell = cells_[pos & (ODRIVE_LOG_QUEUE_SIZE - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.event = event;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    // Pairs with the fence in run: either the writer sees the event or we see it sleep
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (sleeping_.load(std::memory_order_relaxed)) {
+                        wake();
+                    }
+                    return true;
+                }
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     *
+     * Write event from the calling thread
+     * @param event event to write
+     *
+     */
+    void write(const log_event& event)
+    {
+        char line[64 + ODRIVE_LOG_TEXT_SIZE + 256];
+        int length = snprintf(line, sizeof(line), "%ld.%06ld [%s] %s",
+                (long)event.timestamp.tv_sec, event.timestamp.tv_nsec / 1000,
+                log_level_names[event.level], event.message);
+        if (event.text[0] && length < (int)sizeof(line)) {
+            length += snprintf(line + length, sizeof(line) - length, " %s", event.text);
+        }
+        if (event.has_value && length < (int)sizeof(line)) {
+            length += snprintf(line + length, sizeof(line) - length, " %lld", event.value);
+        }
+        fprintf(stdout, "%s\n", line);
+    }
+
+    void flush(void)
+    {
+        size_t target = enqueue_pos_.load(std::memory_order_acquire);
+        while (running_.load() && written_.load(std::memory_order_acquire) < target) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        fflush(stdout);
+    }
+
+    void stop(void)
+    {
+        running_.store(false);
+        wake();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    std::atomic<int> level_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> running_;
+
+private:
+    typedef struct _log_cell {
+        std::atomic<size_t> sequence;
+        log_event event;
+    } log_cell;
+
+    bool pop(log_event& event)
+    {
+        size_t pos = dequeue_pos_;
+        log_cell& cell = cells_[pos & (ODRIVE_LOG_QUEUE_SIZE - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        event = cell.event;
+        cell.sequence.store(pos + ODRIVE_LOG_QUEUE_SIZE, std::memory_order_release);
+        dequeue_pos_ = pos + 1;
+        return true;
+    }
+
+    void wake(void)
+    {
+        wake_seq_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, (int *)&wake_seq_, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    void run(void)
+    {
+        log_event event;
+        for (;;) {
+            if (pop(event)) {
+                write(event);
+                written_.fetch_add(1, std::memory_order_release);
+                continue;
+            }
+            fflush(stdout);
+
+            uint32_t seq = wake_seq_.load(std::memory_order_acquire);
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool queued = pop(event);
+            if (!queued && running_.load()) {
+                syscall(SYS_futex, (int *)&wake_seq_, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+            }
+            sleeping_.store(false, std::memory_order_relaxed);
+
+            if (queued) {
+                write(event);
+                written_.fetch_add(1, std::memory_order_release);
+            } else if (!running_.load()) {
+                // Drained what producers queued before stop
+                break;
+            }
+        }
+        fflush(stdout);
+    }
+
+    log_cell cells_[ODRIVE_LOG_QUEUE_SIZE];
+    std::atomic<size_t> enqueue_pos_;
+    size_t dequeue_pos_;
+    std::atomic<size_t> written_;
+    std::atomic<bool> sleeping_;
+    std::atomic<uint32_t> wake_seq_; // futex word
+    std::thread thread_;
+};
+
+static void stopLogWriter(void);
+
+/**
+ *
+ * Get writer, started by logStart or on first use and stopped at exit
+ * @return log writer
+ *
+ */
+static log_writer *getLogWriter(void)
+{
+    static log_writer *writer = [] {
+        log_writer *w = new log_writer();
+        std::atexit(stopLogWriter);
+        return w;
+    }();
+    return writer;
+}
+
+static void stopLogWriter(void)
+{
+    getLogWriter()->stop();
+}
+
+/**
+ *
+ * Start writer thread ahead of the first event
+ * Called by the odrive constructor so no event on the USB path pays
+ * for allocating the queue and creating the thread
+ *
+ */
+void dhr::logStart(void)
+{
+    getLogWriter();
+}
+
+/**
+ *
+ * Queue event for the writer thread
+ * Called with device locks held, so it only copies the event
+ * @param level ODRIVE_LOG_* level
+ * @param message string literal, not copied
+ * @param text text copied into the event, may be NULL
+ * @param value value printed after the text
+ * @param has_value print value
+ *
+ */
+void dhr::logEvent(int level, const char *message, const char *text,
+                long long value, bool has_value)
+{
+    log_writer *writer = getLogWriter();
+    log_event event;
+
+    if (level < writer->level_.load(std::memory_order_relaxed) || level >= ODRIVE_LOG_NONE) {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &event.timestamp);
+    event.level = level;
+    event.message = message;
+    event.text[0] = 0;
+    if (text) {
+        strncpy(event.text, text, ODRIVE_LOG_TEXT_SIZE - 1);
+        event.text[ODRIVE_LOG_TEXT_SIZE - 1] = 0;
+    }
+    event.value = value;
+    event.has_value = has_value;
+
+    // Past exit the writer is gone, write in place
+    if (!writer->push(event) && !writer->running_.load()) {
+        writer->write(event);
+    }
+}
+
+/**
+ *
+ * Set runtime minimum level
+ * @param level ODRIVE_LOG_* level, levels below ODRIVE_LOG_MIN_LEVEL stay compiled out
+ *
+ */
+void dhr::setLogLevel(int level)
+{
+    getLogWriter()->level_.store(level);
+}
+
+/**
+ *
+ * Wait until queued events are written
+ *
+ */
+void dhr::logFlush(void)
+{
+    getLogWriter()->flush();
+}
+
+/**
+ *
+ * Events lost to a full queue
+ * @return dropped event count
+ *
+ */
+uint64_t dhr::getLogDropped(void)
+{
+    return getLogWriter()->dropped_.load();
+}
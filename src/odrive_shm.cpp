@@ -0,0 +1,572 @@
+#include "odrive_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ *
+ * Check whether a process still runs
+ * @param pid process id
+ * @return true if the process exists, even owned by another user
+ *
+ */
+static bool isProcessAlive(int32_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/**
+ *
+ * Check whether an existing segment is still served by a running daemon
+ * @param name POSIX shared memory name
+ * @return true if the segment is ready and its daemon is alive
+ *
+ */
+static bool isSegmentLive(const std::string& name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(dhr::odrive_shm_segment)) {
+        ::close(fd);
+        return false;
+    }
+    void *memory = mmap(NULL, sizeof(dhr::odrive_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    const dhr::odrive_shm_segment *segment = (const dhr::odrive_shm_segment *)memory;
+    bool live = segment->magic == ODRIVE_SHM_MAGIC && segment->version == ODRIVE_SHM_VERSION &&
+            segment->ready.load(std::memory_order_acquire) && isProcessAlive(segment->owner_pid);
+    munmap(memory, sizeof(dhr::odrive_shm_segment));
+    return live;
+}
+
+/**
+ *
+ * Decide whether a torn frame read should be retried
+ * A daemon that died while writing leaves the sequence odd for good
+ * @param segment mapped segment
+ * @param deadline set on the first retry
+ * @return false if the daemon stopped or the frame stayed torn too long
+ *
+ */
+static bool retryFrame(const dhr::odrive_shm_segment *segment, int64_t *deadline)
+{
+    if (!segment->ready.load(std::memory_order_acquire)) {
+        return false;
+    }
+    int64_t now = dhr::getMonotonicTime();
+    if (*deadline == 0) {
+        *deadline = now + ODRIVE_SHM_READ_TIMEOUT;
+    } else if (now > *deadline) {
+        return false;
+    }
+    sched_yield();
+    return true;
+}
+
+/*
+ * Constructor
+ *
+ */
+
+dhr::odrive_shm_server::odrive_shm_server(){
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_shm_server::~odrive_shm_server(){
+		close();
+}
+
+/**
+ *
+ * Create shared memory segment and describe the published channels
+ * @param name POSIX shared memory name, e.g. /odrive0
+ * @param endpoint odrive enumarated endpoint owned by the daemon
+ * @param odrive_json target json
+ * @param channels names of the values published in every frame
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_shm_server::open(const std::string& name, dhr::odrive *endpoint,
+                const Json::Value& odrive_json, const std::vector<std::string>& channels)
+{
+    if (channels.size() > ODRIVE_SHM_MAX_CHANNELS) {
+        ODRIVE_LOG(ODRIVE_LOG_ERROR, "Error too many shared memory channels");
+        return ODRIVE_FAILED;
+    }
+
+    endpoint_ = endpoint;
+    odrive_json_ = odrive_json;
+    requests_.clear();
+    objects_.clear();
+
+    std::vector<odrive_object> objects;
+    for (const std::string& channel : channels) {
+        odrive_object odo;
+        if (getObjectByName(odrive_json, channel, &odo) != ODRIVE_OK ||
+                getTypeSize(odo.type) == 0 || channel.size() >= ODRIVE_SHM_NAME_SIZE) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error invalid shared memory channel", channel.c_str());
+            return ODRIVE_FAILED;
+        }
+        odo.name = channel;
+        objects.push_back(odo);
+        requests_.push_back(makeReadRequest(odo.id, getTypeSize(odo.type)));
+    }
+
+    // Never reinitialize a segment that clients of a running daemon have mapped
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0 && errno == EEXIST) {
+        if (isSegmentLive(name)) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error shared memory served by another daemon", name.c_str());
+            return ODRIVE_FAILED;
+        }
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_WARNING, "Removing stale shared memory", name.c_str());
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    }
+    if (fd < 0) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error creating shared memory", name.c_str());
+        return ODRIVE_FAILED;
+    }
+    if (ftruncate(fd, sizeof(odrive_shm_segment)) != 0) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error sizing shared memory", name.c_str());
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return ODRIVE_FAILED;
+    }
+    void *memory = mmap(NULL, sizeof(odrive_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error mapping shared memory", name.c_str());
+        shm_unlink(name.c_str());
+        return ODRIVE_FAILED;
+    }
+
+    name_ = name;
+    segment_ = new (memory) odrive_shm_segment();
+    segment_->magic = ODRIVE_SHM_MAGIC;
+    segment_->version = ODRIVE_SHM_VERSION;
+    segment_->owner_pid = getpid();
+    segment_->channel_count = objects.size();
+    for (size_t i = 0; i < objects.size(); i++) {
+        odrive_shm_channel& channel = segment_->channels[i];
+        strncpy(channel.name, objects[i].name.c_str(), ODRIVE_SHM_NAME_SIZE - 1);
+        strncpy(channel.type, objects[i].type.c_str(), ODRIVE_SHM_TYPE_SIZE - 1);
+        channel.id = objects[i].id;
+        channel.size = getTypeSize(objects[i].type);
+    }
+    segment_->frame_sequence.store(0);
+    segment_->command_enqueue.store(0);
+    segment_->command_dequeue = 0;
+    segment_->commands_dropped.store(0);
+    for (uint64_t i = 0; i < ODRIVE_SHM_COMMAND_QUEUE_SIZE; i++) {
+        segment_->commands[i].sequence.store(i, std::memory_order_relaxed);
+        segment_->commands[i].owner_pid.store(0, std::memory_order_relaxed);
+    }
+    stalled_since_ = 0;
+    segment_->ready.store(1, std::memory_order_release);
+
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ * Remove shared memory segment
+ * Clients keep their mapping but see the segment as not ready
+ *
+ */
+void dhr::odrive_shm_server::close(void)
+{
+    if (segment_ != NULL) {
+        segment_->ready.store(0, std::memory_order_release);
+        munmap(segment_, sizeof(odrive_shm_segment));
+        shm_unlink(name_.c_str());
+        segment_ = NULL;
+    }
+}
+
+/**
+ *
+ * Read every channel with one pipelined batch and publish them as one frame
+ * @return ODRIVE_OK on success, the previous frame stays published on failure
+ *
+ */
+int dhr::odrive_shm_server::publish(void)
+{
+    if (segment_ == NULL) {
+        return ODRIVE_FAILED;
+    }
+
+    int result = endpoint_->endpointRequestBatch(requests_);
+    int64_t timestamp = getMonotonicTime();
+    if (result != LIBUSB_SUCCESS) {
+        return ODRIVE_FAILED;
+    }
+
+    uint64_t sequence = segment_->frame_sequence.load(std::memory_order_relaxed);
+    segment_->frame_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < requests_.size(); i++) {
+        uint64_t raw = 0;
+        memcpy(&raw, requests_[i].received_payload.data(),
+                std::min<size_t>(sizeof(raw), requests_[i].received_payload.size()));
+        segment_->frame_values[i].store(raw, std::memory_order_relaxed);
+    }
+    segment_->frame_timestamp.store(timestamp, std::memory_order_relaxed);
+
+    segment_->frame_sequence.store(sequence + 2, std::memory_order_release);
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ * Write queued commands to the target with one pipelined batch
+ * @param processed number of commands taken from the queue, may be NULL
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_shm_server::processCommands(int *processed)
+{
+    std::vector<odrive_request> writes;
+    int ret = ODRIVE_OK;
+
+    if (processed) {
+        *processed = 0;
+    }
+    if (segment_ == NULL) {
+        return ODRIVE_FAILED;
+    }
+
+    for (;;) {
+        uint64_t pos = segment_->command_dequeue;
+        odrive_shm_command& cell = segment_->commands[pos & (ODRIVE_SHM_COMMAND_QUEUE_SIZE - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+            if (skipStalledCommand(pos)) {
+                continue;
+            }
+            break;
+        }
+        stalled_since_ = 0;
+
+        std::string name(cell.name, strnlen(cell.name, ODRIVE_SHM_NAME_SIZE));
+        uint64_t value = cell.value;
+        int size = cell.size;
+        cell.owner_pid.store(0, std::memory_order_relaxed);
+        cell.sequence.store(pos + ODRIVE_SHM_COMMAND_QUEUE_SIZE, std::memory_order_release);
+        segment_->command_dequeue = pos + 1;
+        if (processed) {
+            (*processed)++;
+        }
+
+        std::map<std::string, odrive_object>::iterator it = objects_.find(name);
+        if (it == objects_.end()) {
+            odrive_object odo;
+            if (getObjectByName(odrive_json_, name, &odo) != ODRIVE_OK) {
+                ret = ODRIVE_FAILED;
+                continue;
+            }
+            it = objects_.insert(std::make_pair(name, odo)).first;
+        }
+        if (it->second.access.find('w') == std::string::npos || getTypeSize(it->second.type) != size) {
+            ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error invalid shared memory command", name.c_str());
+            ret = ODRIVE_FAILED;
+            continue;
+        }
+        writes.push_back(makeWriteRequest(it->second.id,
+                commBuffer((uint8_t *)&value, (uint8_t *)&value + size)));
+    }
+
+    if (!writes.empty() && endpoint_->endpointRequestBatch(writes) != LIBUSB_SUCCESS) {
+        ret = ODRIVE_FAILED;
+    }
+    return ret;
+}
+
+/**
+ *
+ * Skip the head cell if the client that claimed it died before publishing
+ * Without this the queue would stall on that cell until the segment is recreated
+ * @param pos queue position of the head cell
+ * @return true if the cell was skipped
+ *
+ */
+bool dhr::odrive_shm_server::skipStalledCommand(uint64_t pos)
+{
+    if (segment_->command_enqueue.load(std::memory_order_acquire) <= pos) {
+        stalled_since_ = 0;
+        return false;
+    }
+
+    int64_t now = getMonotonicTime();
+    if (stalled_since_ == 0) {
+        stalled_since_ = now;
+        return false;
+    }
+    odrive_shm_command& cell = segment_->commands[pos & (ODRIVE_SHM_COMMAND_QUEUE_SIZE - 1)];
+    if (now - stalled_since_ < ODRIVE_SHM_COMMAND_TIMEOUT ||
+            isProcessAlive(cell.owner_pid.load(std::memory_order_acquire))) {
+        return false;
+    }
+
+    // Fails if the client published after all, then the cell is consumed as usual
+    cell.owner_pid.store(0, std::memory_order_relaxed);
+    uint64_t expected = pos;
+    if (!cell.sequence.compare_exchange_strong(expected, pos + ODRIVE_SHM_COMMAND_QUEUE_SIZE,
+            std::memory_order_acq_rel)) {
+        return false;
+    }
+    segment_->command_dequeue = pos + 1;
+    segment_->commands_dropped.fetch_add(1, std::memory_order_relaxed);
+    stalled_since_ = 0;
+    ODRIVE_LOG(ODRIVE_LOG_WARNING, "Skipped command of a dead shared memory client");
+    return true;
+}
+
+/*
+ * Constructor
+ *
+ */
+
+dhr::odrive_shm_client::odrive_shm_client(){
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_shm_client::~odrive_shm_client(){
+		close();
+}
+
+/**
+ *
+ * Map shared memory segment created by the daemon
+ * @param name POSIX shared memory name used by the daemon
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_shm_client::open(const std::string& name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error opening shared memory", name.c_str());
+        return ODRIVE_FAILED;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(odrive_shm_segment)) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error shared memory not ready", name.c_str());
+        ::close(fd);
+        return ODRIVE_FAILED;
+    }
+    void *memory = mmap(NULL, sizeof(odrive_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error mapping shared memory", name.c_str());
+        return ODRIVE_FAILED;
+    }
+
+    segment_ = (odrive_shm_segment *)memory;
+    if (!segment_->ready.load(std::memory_order_acquire) ||
+            segment_->magic != ODRIVE_SHM_MAGIC || segment_->version != ODRIVE_SHM_VERSION) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error shared memory not ready", name.c_str());
+        close();
+        return ODRIVE_FAILED;
+    }
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ * Unmap shared memory segment
+ *
+ */
+void dhr::odrive_shm_client::close(void)
+{
+    if (segment_ != NULL) {
+        munmap(segment_, sizeof(odrive_shm_segment));
+        segment_ = NULL;
+    }
+}
+
+/**
+ *
+ * Find published channel
+ * @param name value name
+ * @return channel index, -1 if the daemon does not publish it
+ *
+ */
+int dhr::odrive_shm_client::getChannel(const std::string& name)
+{
+    if (segment_ == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < segment_->channel_count; i++) {
+        if (!name.compare(0, ODRIVE_SHM_NAME_SIZE, segment_->channels[i].name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ *
+ * Copy all channels of the latest frame
+ * Retries only while the daemon is writing that very frame
+ * @param values raw little endian values, one per channel
+ * @param timestamp monotonic ns of the frame, may be NULL
+ * @return ODRIVE_OK on success, ODRIVE_FAILED if nothing was published yet
+ *         or the daemon stopped in the middle of a frame
+ *
+ */
+int dhr::odrive_shm_client::readFrame(std::vector<uint64_t>& values, int64_t *timestamp)
+{
+    uint64_t before, after;
+    int64_t frame_timestamp, deadline = 0;
+
+    if (segment_ == NULL || !segment_->ready.load(std::memory_order_acquire)) {
+        return ODRIVE_FAILED;
+    }
+    values.resize(segment_->channel_count);
+
+    for (;;) {
+        before = segment_->frame_sequence.load(std::memory_order_acquire);
+        for (size_t i = 0; i < values.size(); i++) {
+            values[i] = segment_->frame_values[i].load(std::memory_order_relaxed);
+        }
+        frame_timestamp = segment_->frame_timestamp.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = segment_->frame_sequence.load(std::memory_order_relaxed);
+        if (!(before & 1) && before == after) {
+            break;
+        }
+        if (!retryFrame(segment_, &deadline)) {
+            return ODRIVE_FAILED;
+        }
+    }
+
+    if (timestamp) {
+        *timestamp = frame_timestamp;
+    }
+    return before ? ODRIVE_OK : ODRIVE_FAILED;
+}
+
+/**
+ *
+ * Latest value of one channel
+ * @param channel channel index from getChannel
+ * @param value value read, its type must match the channel
+ * @param timestamp monotonic ns of the frame, may be NULL
+ * @return ODRIVE_OK on success, ODRIVE_FAILED if the daemon stopped in the middle of a frame
+ *
+ */
+template<typename T>
+int dhr::odrive_shm_client::read(int channel, T& value, int64_t *timestamp)
+{
+    uint64_t before, after, raw;
+    int64_t frame_timestamp, deadline = 0;
+
+    if (segment_ == NULL || channel < 0 || channel >= (int)segment_->channel_count ||
+            segment_->channels[channel].size != sizeof(value)) {
+        return ODRIVE_FAILED;
+    }
+
+    for (;;) {
+        before = segment_->frame_sequence.load(std::memory_order_acquire);
+        raw = segment_->frame_values[channel].load(std::memory_order_relaxed);
+        frame_timestamp = segment_->frame_timestamp.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = segment_->frame_sequence.load(std::memory_order_relaxed);
+        if (!(before & 1) && before == after) {
+            break;
+        }
+        if (!retryFrame(segment_, &deadline)) {
+            return ODRIVE_FAILED;
+        }
+    }
+
+    memcpy(&value, &raw, sizeof(value));
+    if (timestamp) {
+        *timestamp = frame_timestamp;
+    }
+    return before ? ODRIVE_OK : ODRIVE_FAILED;
+}
+
+/**
+ *
+ * Queue a write for the daemon
+ * @param object name
+ * @param value value to be written, its type must match the object
+ * @return ODRIVE_OK on success, ODRIVE_FAILED if the queue is full
+ *
+ */
+template<typename T>
+int dhr::odrive_shm_client::sendCommand(const std::string& object, const T& value)
+{
+    if (segment_ == NULL || object.size() >= ODRIVE_SHM_NAME_SIZE) {
+        return ODRIVE_FAILED;
+    }
+
+    uint64_t pos = segment_->command_enqueue.load(std::memory_order_relaxed);
+    for (;;) {
+        odrive_shm_command& cell = segment_->commands[pos & (ODRIVE_SHM_COMMAND_QUEUE_SIZE - 1)];
+        int64_t diff = (int64_t)cell.sequence.load(std::memory_order_acquire) - (int64_t)pos;
+        if (diff == 0) {
+            if (segment_->command_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.owner_pid.store(getpid(), std::memory_order_relaxed);
+                memset(cell.name, 0, ODRIVE_SHM_NAME_SIZE);
+                memcpy(cell.name, object.data(), object.size());
+                cell.value = 0;
+                memcpy(&cell.value, &value, sizeof(value));
+                cell.size = sizeof(value);
+
+                // Fails only if the daemon took this client for dead and skipped the cell
+                uint64_t expected = pos;
+                return cell.sequence.compare_exchange_strong(expected, pos + 1, std::memory_order_release,
+                        std::memory_order_relaxed) ? ODRIVE_OK : ODRIVE_FAILED;
+            }
+        } else if (diff < 0) {
+            segment_->commands_dropped.fetch_add(1, std::memory_order_relaxed);
+            return ODRIVE_FAILED;
+        } else {
+            pos = segment_->command_enqueue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+
+template int dhr::odrive_shm_client::read(int, bool&, int64_t *);
+template int dhr::odrive_shm_client::read(int, short&, int64_t *);
+template int dhr::odrive_shm_client::read(int, int&, int64_t *);
+template int dhr::odrive_shm_client::read(int, float&, int64_t *);
+template int dhr::odrive_shm_client::read(int, uint8_t&, int64_t *);
+template int dhr::odrive_shm_client::read(int, uint16_t&, int64_t *);
+template int dhr::odrive_shm_client::read(int, uint32_t&, int64_t *);
+template int dhr::odrive_shm_client::read(int, uint64_t&, int64_t *);
+
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const bool&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const short&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const int&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const float&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const uint8_t&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const uint16_t&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const uint32_t&);
+template int dhr::odrive_shm_client::sendCommand(const std::string&, const uint64_t&);
@@ -0,0 +1,310 @@
+#include "odrive_subscribe.h"
+
+#include <cmath>
+
+/**
+ *
+ *  Convert raw value to double
+ *  @param type type name from target json
+ *  @param value raw value
+ *  @return value, 64 bit integers lose precision above 2^53
+ *
+ */
+static double valueToDouble(const std::string& type, const commBuffer& value)
+{
+    uint64_t raw = 0;
+    int size = dhr::getTypeSize(type);
+
+    memcpy(&raw, value.data(), std::min<size_t>(size, value.size()));
+
+    if (!type.compare("float")) {
+        float f;
+        memcpy(&f, &raw, sizeof(f));
+        return f;
+    }
+    if (type[0] == 'i' && size < 8) {
+        int shift = 64 - 8 * size;
+        return (double)((int64_t)(raw << shift) >> shift);
+    }
+    if (type[0] == 'i') {
+        return (double)(int64_t)raw;
+    }
+    return (double)raw;
+}
+
+/*
+ * Constructor
+ * @param endpoint odrive enumarated endpoint
+ * @param odrive_json target json
+ * @param min_interval_ns fastest poll of a changing value
+ * @param max_interval_ns slowest poll of a quiet value
+ */
+
+dhr::odrive_subscriber::odrive_subscriber(dhr::odrive *endpoint, const Json::Value& odrive_json,
+        int64_t min_interval_ns, int64_t max_interval_ns)
+    : endpoint_(endpoint), odrive_json_(odrive_json), min_interval_ns_(min_interval_ns),
+      max_interval_ns_(std::max(min_interval_ns, max_interval_ns)){
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_subscriber::~odrive_subscriber(){
+		stop();
+}
+
+/**
+ *
+ *  Subscribe to changes larger than a deadband
+ *  The first sample is always notified
+ *  @param name object name, e.g. axis0.current_state
+ *  @param deadband change from the last notified value to notify
+ *  @param callback called with the subscription index and the new value
+ *  @return subscription index, -1 on error
+ *
+ */
+int dhr::odrive_subscriber::subscribe(const std::string& name, double deadband,
+                dhr::odrive_change_callback callback)
+{
+    return add(name, deadband, odrive_change_predicate(), callback);
+}
+
+/**
+ *
+ *  Subscribe to changes accepted by a predicate
+ *  The first sample is always notified
+ *  @param name object name, e.g. axis0.motor.fet_thermistor.temperature
+ *  @param predicate called with the last notified and the new value,
+ *  under the subscriber lock
+ *  @param callback called with the subscription index and the new value
+ *  @return subscription index, -1 on error
+ *
+ */
+int dhr::odrive_subscriber::subscribe(const std::string& name, dhr::odrive_change_predicate predicate,
+                dhr::odrive_change_callback callback)
+{
+    if (!predicate) {
+        return -1;
+    }
+    return add(name, 0, predicate, callback);
+}
+
+int dhr::odrive_subscriber::add(const std::string& name, double deadband,
+                dhr::odrive_change_predicate predicate, dhr::odrive_change_callback callback)
+{
+    subscription entry;
+
+    if (getObjectByName(odrive_json_, name, &entry.object) != ODRIVE_OK) {
+        return -1;
+    }
+    if (!getTypeSize(entry.object.type)) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Unsupported subscription type:", entry.object.type.c_str());
+        return -1;
+    }
+
+    entry.deadband = std::fabs(deadband);
+    entry.predicate = predicate;
+    entry.callback = callback;
+    entry.active = true;
+    entry.sampled = false;
+    entry.notified = 0;
+    entry.next_ns = getMonotonicTime();
+    entry.stats.interval_ns = min_interval_ns_;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    subscriptions_.push_back(entry);
+    wake_.notify_one();
+    return subscriptions_.size() - 1;
+}
+
+/**
+ *
+ *  Stop polling a subscription
+ *  @param subscription subscription index
+ *
+ */
+void dhr::odrive_subscriber::unsubscribe(int subscription)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (subscription >= 0 && subscription < (int)subscriptions_.size()) {
+        subscriptions_[subscription].active = false;
+    }
+}
+
+/**
+ *
+ *  Read due values in one batch, adapt their intervals and notify
+ *  @param next_ns monotonic time the next value is due, may be NULL
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_subscriber::poll(int64_t *next_ns)
+{
+    std::vector<odrive_request> requests;
+    std::vector<int> due;
+    int64_t now = getMonotonicTime();
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (size_t i = 0; i < subscriptions_.size(); i++) {
+            const subscription& entry = subscriptions_[i];
+            if (entry.active && entry.next_ns <= now) {
+                due.push_back(i);
+                requests.push_back(makeReadRequest(entry.object.id, getTypeSize(entry.object.type)));
+            }
+        }
+    }
+
+    int ret = LIBUSB_SUCCESS;
+    if (!requests.empty()) {
+        ret = endpoint_->endpointRequestBatch(requests);
+    }
+
+    std::vector<std::pair<odrive_change_callback, std::pair<int, double> > > notifications;
+    int64_t next;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        now = getMonotonicTime();
+
+        for (size_t k = 0; k < due.size(); k++) {
+            subscription& entry = subscriptions_[due[k]];
+            if (!entry.active) {
+                continue;
+            }
+
+            const odrive_request& request = requests[k];
+            if (request.status != LIBUSB_SUCCESS ||
+                    request.received_payload.size() != (size_t)getTypeSize(entry.object.type)) {
+                entry.stats.errors++;
+                entry.next_ns = now + entry.stats.interval_ns;
+                continue;
+            }
+
+            double value = valueToDouble(entry.object.type, request.received_payload);
+            bool moved, notify;
+            if (entry.predicate) {
+                moved = value != entry.stats.value;
+                notify = !entry.sampled || entry.predicate(entry.notified, value);
+            } else {
+                moved = std::fabs(value - entry.stats.value) > entry.deadband;
+                notify = !entry.sampled || std::fabs(value - entry.notified) > entry.deadband;
+            }
+
+            // Spend polls where the signal is
+            if (entry.sampled && moved) {
+                entry.stats.interval_ns = std::max(entry.stats.interval_ns / 2, min_interval_ns_);
+            } else if (entry.sampled) {
+                entry.stats.interval_ns = std::min(entry.stats.interval_ns * 2, max_interval_ns_);
+            }
+
+            entry.sampled = true;
+            entry.stats.value = value;
+            entry.stats.samples++;
+            entry.next_ns = now + entry.stats.interval_ns;
+
+            if (notify) {
+                entry.notified = value;
+                entry.stats.notifications++;
+                notifications.push_back(std::make_pair(entry.callback, std::make_pair(due[k], value)));
+            }
+        }
+
+        next = nextDue(now);
+    }
+
+    for (const auto& notification : notifications) {
+        if (notification.first) {
+            notification.first(notification.second.first, notification.second.second);
+        }
+    }
+
+    if (next_ns != NULL) {
+        *next_ns = next;
+    }
+    return ret == LIBUSB_SUCCESS ? ODRIVE_OK : ODRIVE_FAILED;
+}
+
+/**
+ *
+ *  Poll on a thread until stop
+ *  @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_subscriber::start(void)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (running_) {
+        return ODRIVE_FAILED;
+    }
+    running_ = true;
+    thread_ = std::thread(&odrive_subscriber::run, this);
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ *  Earliest time an active subscription is due
+ *  Called with lock_ held
+ *  @param now monotonic time
+ *  @return monotonic time, at most max_interval_ns after now
+ *
+ */
+int64_t dhr::odrive_subscriber::nextDue(int64_t now)
+{
+    int64_t next = now + max_interval_ns_;
+    for (const subscription& entry : subscriptions_) {
+        if (entry.active) {
+            next = std::min(next, entry.next_ns);
+        }
+    }
+    return next;
+}
+
+void dhr::odrive_subscriber::run(void)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+
+    while (running_) {
+        lock.unlock();
+        poll();
+        lock.lock();
+
+        // Recomputed under the lock: a subscription added while polling
+        // notified nobody, but its next_ns is already visible here
+        if (running_) {
+            int64_t now = getMonotonicTime();
+            wake_.wait_for(lock, std::chrono::nanoseconds(nextDue(now) - now));
+        }
+    }
+}
+
+void dhr::odrive_subscriber::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        wake_.notify_one();
+    }
+    thread_.join();
+}
+
+/**
+ *
+ *  Subscription metrics
+ *  @param subscription subscription index
+ *  @return copy of the metrics
+ *
+ */
+dhr::odrive_subscription_stats dhr::odrive_subscriber::getStats(int subscription)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (subscription < 0 || subscription >= (int)subscriptions_.size()) {
+        return odrive_subscription_stats();
+    }
+    return subscriptions_[subscription].stats;
+}
@@ -0,0 +1,140 @@
+#include "odrive_trace.h"
+
+/*
+ * Constructor
+ * @param capacity ring size, rounded up to a power of two; one slot less is kept between flushes
+ */
+
+dhr::odrive_tracer::odrive_tracer(size_t capacity) : head_(0){
+		size_t size = 1;
+		while (size < capacity) {
+				size <<= 1;
+		}
+		records_.resize(size);
+		staging_.resize(size);
+		mask_ = size - 1;
+}
+
+/*
+ * Destructor
+ *
+ */
+
+dhr::odrive_tracer::~odrive_tracer(){
+		close();
+}
+
+/**
+ *
+ * Start trace file
+ * Records before open are discarded
+ * @param path trace file path
+ * @param json_crc CRC of the target json, see odrive::getJsonCrc
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_tracer::open(const std::string& path, uint16_t json_crc)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(flush_lock_);
+    file_ = fopen(path.c_str(), "wb");
+    if (file_ == NULL) {
+        ODRIVE_LOG_TEXT(ODRIVE_LOG_ERROR, "Error opening trace file", path.c_str());
+        return ODRIVE_FAILED;
+    }
+
+    odrive_trace_header header;
+    header.magic = htole32(ODRIVE_TRACE_MAGIC);
+    header.version = htole16(ODRIVE_TRACE_VERSION);
+    header.record_size = htole16(sizeof(odrive_trace_record));
+    header.json_crc = htole16(json_crc);
+    header.reserved = 0;
+    fwrite(&header, sizeof(header), 1, file_);
+
+    tail_ = head_.load(std::memory_order_acquire);
+    dropped_ = 0;
+    return ODRIVE_OK;
+}
+
+/**
+ *
+ * Flush and close trace file
+ *
+ */
+void dhr::odrive_tracer::close(void)
+{
+    flush();
+
+    std::lock_guard<std::mutex> lock(flush_lock_);
+    if (file_ != NULL) {
+        fclose(file_);
+        file_ = NULL;
+    }
+}
+
+/**
+ *
+ * Write records recorded since last flush
+ * Records are copied out first; those the recorder overwrote meanwhile
+ * are dropped rather than written torn.
+ * @return ODRIVE_OK on success
+ *
+ */
+int dhr::odrive_tracer::flush(void)
+{
+    std::lock_guard<std::mutex> lock(flush_lock_);
+    if (file_ == NULL) {
+        return ODRIVE_FAILED;
+    }
+
+    // The recorder fills slot head & mask_ before publishing head + 1, so
+    // index head - capacity, which shares that slot, may be half written
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t capacity = mask_ + 1;
+    if (head - tail_ >= capacity) {
+        dropped_ += head - tail_ - capacity + 1;
+        tail_ = head - capacity + 1;
+    }
+
+    size_t count = head - tail_;
+    for (size_t i = 0; i < count; i++) {
+        staging_[i] = records_[(tail_ + i) & mask_];
+    }
+
+    // Anything a full ring behind the current head may be torn. The fence
+    // keeps the copies above from moving after the head is read again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t overwritten = head_.load(std::memory_order_relaxed);
+    size_t first = 0;
+    if (overwritten - tail_ >= capacity) {
+        first = std::min<uint64_t>(overwritten - tail_ - capacity + 1, count);
+        dropped_ += first;
+    }
+
+    // Records are little endian on disk, like the header
+    for (size_t i = first; i < count; i++) {
+        odrive_trace_record& r = staging_[i];
+        r.timestamp_ns = (int64_t)htole64((uint64_t)r.timestamp_ns);
+        r.seq_no = htole16(r.seq_no);
+        r.endpoint_id = htole16(r.endpoint_id);
+        r.length = htole16(r.length);
+    }
+    size_t written = fwrite(&staging_[first], sizeof(odrive_trace_record), count - first, file_);
+    tail_ = head;
+    fflush(file_);
+
+    return written == count - first ? ODRIVE_OK : ODRIVE_FAILED;
+}
+
+/**
+ *
+ * Records lost because flush did not keep up
+ * @return dropped record count
+ *
+ */
+uint64_t dhr::odrive_tracer::getDropped(void)
+{
+    std::lock_guard<std::mutex> lock(flush_lock_);
+    return dropped_;
+}